@@ -1,705 +1,6544 @@
+#define _GNU_SOURCE                           // fopencookie, used to count the system calls of saves
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <fcntl.h>
 #include <string.h>
 #include <time.h>
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __x86_64__
+#include <nmmintrin.h>
+#endif
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <dirent.h>
 
-#define MAX_LOG_ENTRIES 16                    // maximum number of log entries for a file
-#define MAX_BUFFSIZE 102400                   // maximum size of the file
+#define READ_CHUNK 65536                      // read size for sources whose size is not known up front
+#define DELTA_MAX_LEN (1 << 24)               // largest base a delta is computed against
+#define STATE_MAGIC "VFSE"                    // identifies a saved state file and its format version
+#define JOURNAL_MAGIC "VFSJ"                  // identifies a journal of changes made after a saved state
+#define JOURNAL_MIN_COMPACT (1 << 20)         // journal size below which saves never rewrite the base image
+#define ARENA_BLOCK 4096                      // size of the first block of an arena, later blocks double
+#define ARENA_BLOCK_MAX (4 << 20)             // blocks stop doubling at this size
+#define PAGE_FILES 64                         // file slots per page of a file table
+#define POOL_GRAIN 8                          // pages a worker claims at a time
+#define MAX_WORKERS 256                       // largest worker count 'set workers' accepts
+#define MAX_ARGS 6                            // words of a command line, extra words are ignored
+#define BATCH_BUFFER (1 << 20)                // output buffer size in batch mode
+#define DIFF_CONTEXT 3                        // unchanged lines shown around each change of a diff
+#define DIFF_PREFETCH 16                      // lines ahead whose id slot is prefetched while lines are numbered
+#define DIFF_MIN_COST 4096                    // edit cost a diff always searches before settling for a good split
+#define HIST_SUB_BITS 4                       // latency histogram: 16 buckets per power of two, within 6.25%
+#define HIST_BUCKETS (64 << HIST_SUB_BITS)    // buckets covering every 64-bit nanosecond count
+#define BENCH_LINE 64                         // bytes per line of generated benchmark content, newline included
+#define SERVE_BACKLOG 128                     // pending connections the daemon's socket queues
+#define DELTA_BLOCK 16                        // granularity at which deltas look for copies from the base
+#define CACHE_BUDGET (64 << 20)               // bytes of unpacked content the content cache holds by default
+#define CHUNK_FILE_MIN (1 << 20)              // content from this size on is split into content-defined chunks
+#define IMPORT_BATCH 1024                     // files an import reads and packs in parallel before committing them
+#define CRC_POLY 0x82f63b78u                  // CRC32C (Castagnoli) polynomial, bit-reflected
+#define CRC_LANE 4096                         // bytes per lane of the three-way interleaved hardware CRC
+#define CRC_SEGMENT (1 << 20)                 // bytes of a state file section one verify job checksums
+#define CHUNK_MIN 8192                        // smallest chunk the chunker cuts
+#define CHUNK_AVG 16384                       // chunk size the boundary masks are normalised around
+#define CHUNK_MAX 65536                       // largest chunk the chunker cuts
+#define CHUNK_MASK_SMALL (0x7fffULL << 49)    // 15 bits, makes boundaries unlikely below CHUNK_AVG
+#define CHUNK_MASK_LARGE (0x1fffULL << 51)    // 13 bits, makes boundaries likely above CHUNK_AVG
+#define CODEC_MIN 64                          // blobs stored below this size are never compressed
+#define CODEC_HIGH_MIN 4096                   // 'set codec auto' uses the high-ratio codec from this size on
+#define CODEC_SAMPLE 4096                     // bytes whose entropy decides whether compression is tried
+#define CODEC_MAX_ENTROPY (15 << 15)          // 7.5 bits per byte, above it a sample is taken as incompressible
+#define LZ_MIN_MATCH 4                        // shortest match the LZ codecs encode
+#define LZ_WINDOW 65535                       // furthest back a match may start
+#define LZ_FAST_BITS 14                       // log2 of the fast codec's hash table size
+#define LZ_HIGH_BITS 16                       // log2 of the high-ratio codec's hash table size
+#define LZ_HIGH_DEPTH 32                      // candidates the high-ratio codec tries per position
+#define LZ_HIGH_NICE 64                       // match length the high-ratio codec stops searching at
+
+// CONTENT BLOB: immutable, refcounted and addressed by the hash of its content
+// A blob is a keyframe holding the full content, a delta against a base blob, or (for large content)
+// a list of content-defined chunks that are blobs of their own, so edits only add the chunks they touch.
+typedef struct Blob{
+    uint64_t hash;                            // hash of the full content, used as its address
+    size_t len;                               // length of the full content in bytes
+    int refs;                                 // number of log entries and deltas referring to this blob
+    int depth;                                // deltas to apply on top of the nearest keyframe (0 = keyframe)
+    struct Blob* base;                        // blob the delta applies to, NULL for a keyframe
+    char* data;                               // full content (NUL terminated) or encoded delta, packed by codec
+    size_t stored;                            // number of bytes held in data
+    size_t raw;                               // number of bytes data unpacks to
+    int codec;                                // codec data is packed with, CODEC_NONE when held as is
+    struct Blob** chunks;                     // chunk blobs in content order, NULL unless chunked
+    int chunk_count;                          // number of entries in chunks
+    int save_id;                              // position of the blob in the saved blob table
+    struct CacheEntry* cached;                // content cache entry holding the full content, NULL when not cached
+    struct Blob* next;                        // next blob in the same hash bucket
+}Blob;
+
+// CONTENT CACHE: full contents blob_get had to unpack, rebuild from a delta chain or join from chunks,
+// kept so reading them again is a lookup. Entries are ordered by use and the least recently used ones
+// go once the cache holds more than cache_budget bytes; an entry a reader still holds is skipped.
+typedef struct CacheEntry{
+    Blob* blob;                               // blob whose content this is
+    char* content;                            // full content, NUL terminated
+    int pins;                                 // blob_get calls not yet paired with blob_put
+    struct CacheEntry* prev;                  // more recently used entry
+    struct CacheEntry* next;                  // less recently used entry
+}CacheEntry;
 
 typedef struct{
-    char* content;                            // char array to store the file content
+    Blob* content;                            // shared blob holding the file content
     char* comment;                            // char array to store the comment 
     char* author_name;                        // char array to hold the author name
     time_t timestamp;                         // timestamp for log entry
     int version_id;                           // unique version identifier
 }LogEntry;
 
-// FILE DESCRIPTION
+// a version in the cold tier: its record and the hash of its content, so versions can be told apart
+// (and matched against the search index) without reading the record back
+typedef struct{
+    uint64_t ref;                              // cold tier reference of the record
+    uint64_t hash;                             // hash of the content, as its blob had it
+}ColdRef;
+
+// a change to a file that its versions do not record: a deletion, a recovery, or a version made current, which
+// is only recorded once revert has taken the versions out of time order. Used in place in the state file too
+typedef struct{
+    int64_t at;                                // time of the change
+    uint64_t hash;                             // EVENT_CONTENT: hash of the content made current
+    int32_t kind;                              // EVENT_*
+    int32_t reserved;
+}FileEvent;
+
+// FILE EVENT KINDS
+enum{
+    EVENT_CONTENT = 0,                         // a version became the current content, by add or revert
+    EVENT_DELETE,
+    EVENT_RECOVER
+};
+
+// FILE DESCRIPTION: the history of a file, the cold part of its page slot; the name comes from the file
+// id and whether the slot is used or deleted from the page's hot region
+// Versions are numbered oldest first: the cold ones, spilled to the cold tier and known by reference only,
+// then the hot ones held in memory, the last of which is the current content. A file with a single hot
+// version keeps it inline, so most files need no allocation besides their page.
+typedef struct{
+    LogEntry* log_history;                     // hot versions, oldest first; points at first_log until it grows
+    ColdRef* cold;                             // cold tier references of the older versions, oldest first
+    int log_count;                             // keeps the count of versions, cold and hot
+    int hot_count;                             // number of entries in log_history
+    int hot_cap;                               // entries allocated in log_history, 1 while inline
+    int cold_count;                            // number of entries in cold
+    int cold_cap;                              // entries allocated in cold, cold_count while it is in the state file
+    int event_count;                           // number of entries in events
+    FileEvent* events;                         // changes the versions do not record, oldest first; a heap array
+                                               // holds event_cap(event_count) entries
+    LogEntry first_log;                        // storage of log_history while the file has one hot version
+}File;
+
+// COLD TIER RECORD: a version spilled out of memory, followed by its comment and author (NUL terminated)
+// and its content packed with codec. Records are written once and known by their offset in the cold tier:
+// offsets below cold_mapped_len are in the cold section of the mapped state file, later ones in the spill file.
+typedef struct{
+    uint64_t len;                              // content length
+    uint64_t stored;                           // bytes of packed content
+    int64_t timestamp;
+    int32_t version_id;
+    int32_t codec;
+    uint32_t comment_len;
+    uint32_t author_len;
+}ColdRecord;
+
+// a version read back from the cold tier
+typedef struct{
+    ColdRecord rec;
+    char* comment;                             // malloc'd, author_name follows it in the same allocation
+    char* author_name;
+    char* content;                             // malloc'd separately, NULL unless it was asked for
+}ColdEntry;
+
+// CODEC: compresses blob data; every codec packs data into dst (at least lz_bound(len) bytes)
+// and unpacks it into exactly raw bytes, returning -1 when the packed data is malformed
+typedef struct{
+    const char* name;                          // name 'set codec' takes
+    size_t (*pack)(const char *src, size_t len, char *dst);
+    int (*unpack)(const char *src, size_t len, char *dst, size_t raw);
+}Codec;
+
+// hash chains of the high-ratio codec, sized to the input so small blobs do not pay for a full window
+typedef struct{
+    uint32_t* head;                            // hash -> latest position, UINT32_MAX when none
+    uint32_t* chain;                           // position & mask -> previous position with the same hash
+    int bits;                                  // log2 of the number of head entries
+    uint32_t mask;                             // chain entries - 1
+}LzChains;
+
+enum{
+    CODEC_NONE = 0,
+    CODEC_FAST,                                // greedy LZ, one candidate per position
+    CODEC_HIGH,                                // LZ with hash chains and lazy matching, same format as CODEC_FAST
+    CODEC_COUNT,
+    CODEC_AUTO = CODEC_COUNT                   // chosen per blob by size and entropy
+};
+
+// ARENA: bump allocator for strings that are all released together
+typedef struct ArenaBlock{
+    struct ArenaBlock* next;                   // previously filled block
+    size_t used;                               // bytes handed out from data
+    size_t cap;                                // bytes available in data
+    char data[];
+}ArenaBlock;
+
+typedef struct{
+    ArenaBlock* head;                          // block currently being filled
+    size_t bytes;                              // bytes handed out over all blocks
+}Arena;
+
+// FILE TABLE: persistent two-level vector from a file id to its File
+// The live file system and every snapshot hold a table; tables and their pages are refcounted and never
+// changed while shared, so a snapshot or rollback only takes a reference and a change copies the page list
+// and the one page it touches.
+// A page keeps what tree-wide scans read in a packed hot region ahead of the histories: listing the files
+// or comparing two snapshots touches two bitmasks and the latest blob per slot, not the File slots.
+typedef struct{
+    int refs;                                  // number of tables holding this page
+    int save_id;                               // position of the page in the saved page table
+    Arena arena;                               // owns the comments and authors of the files in this page
+    size_t garbage;                            // bytes of arena no longer referenced by any of its files
+    uint64_t used;                             // bit k is set when slot k holds a file
+    uint64_t deleted;                          // bit k is set when the file in slot k is deleted
+    Blob* latest[PAGE_FILES];                  // current content of each file, the reference is its history's
+    File files[PAGE_FILES];                    // file id % PAGE_FILES -> history of the file
+}FilePage;
+
 typedef struct{
-    char* name;                                // char array to hold the file name
-    LogEntry log_history[MAX_LOG_ENTRIES];     // stores the log history of the file
-    int log_count;                             // keeps the count of changes made to the file
-    int is_deleted;                            // flag to indicate if the file is deleted
-    int front;                                 // points to the start of a file's log_history queue
-    int rear;                                  // points to the last of a file's log_history queue
-}File;                                         
+    int refs;                                  // number of snapshots (and the live file system) holding this table
+    int page_count;                            // number of entries in pages
+    FilePage** pages;                          // file id / PAGE_FILES -> page, NULL when none of its ids are used
+}FileTable;
 
 typedef struct{
-    File* files;                               // list of files
-    int file_count;                            // number of files present at the instance
+    FileTable* table;                          // files present at the instance
     char* tag;                                 // tag for identification
     time_t timestamp;                          // timestamp of the snapshot
     int is_obsolete;                           // flag to indicate if the snapshot is deleted
 }Snapshot;
 
-static File *files = NULL;                      // maintains the files in files array
-static int file_count = 0;                      // keeps track of the number of files in the files array
-static Snapshot *snapshots = NULL;              // stores all the snapshots created in snapshots array
-static int snapshot_count = 0;                  // keeps track of the number of snapshots created so far
-static int is_change = 0;                       // tracks if there has been any change in the file system
+// a rollback of the live tree, keeping the tree it replaced: what happened after the snapshot's time is gone
+// from the live histories but not from that tree's
+typedef struct{
+    time_t at;                                 // time of the rollback
+    FileTable* table;                          // live tree before the rollback, one reference held
+}Rollback;
 
+// NAME INDEX: open addressing (linear probing) from a name to its file id or snapshot slot
+typedef struct{
+    uint64_t hash;                             // hash of the name
+    int slot;                                  // slot in the indexed array, -1 when the position is free
+}IndexSlot;
 
-// save the file system state to disk
-void save_to_disk(const char *filename){
-    FILE *fp = fopen(filename, "wb");
-    if(!fp){
-        perror("Error opening file for writing");
-        return;
-    }
+typedef struct{
+    IndexSlot* slots;                          // probe table, a power of two in size
+    size_t cap;                                // number of positions in slots
+    size_t used;                               // number of occupied positions
+}NameIndex;
 
-    fwrite(&file_count, sizeof(int), 1, fp);
-    fwrite(&snapshot_count, sizeof(int), 1, fp);
+// WORKER POOL: threads that split the items of a job between them, the calling thread included
+// Items are claimed POOL_GRAIN at a time from a shared counter, so a worker that finishes early takes over
+// the remaining items instead of idling.
+typedef struct{
+    void (*fn)(void *ctx, int begin, int end); // processes items begin..end-1
+    void* ctx;                                 // passed to fn
+    int count;                                 // number of items in the job
+    int next;                                  // first item not claimed yet
+    int active;                                // pool threads still working on the job
+    unsigned long generation;                  // bumped for every job so sleeping threads notice it
+}PoolJob;
 
-    for(int i = 0; i < file_count; i++){
-        int name_len = strlen(files[i].name);
-        fwrite(&name_len, sizeof(int), 1, fp);
-        fwrite(files[i].name, sizeof(char), name_len, fp);
+// IMPORT: a source file of an import. Pool workers read and hash a batch, the calling thread marks the
+// duplicates within it, workers build the blobs of the rest and the calling thread commits the batch in
+// order, so only the commit changes the blob store and the file table.
+typedef struct{
+    char* name;                                // file name: the path below the imported directory
+    char* text;                                // content as read, NULL when the file could not be read
+    size_t len;
+    uint64_t hash;                             // hash of text
+    int dup;                                   // an earlier entry of the batch has the same content
+    Blob* blob;                                // unlinked blob built for text, NULL when stored already, a dup or chunked
+}ImportEntry;
 
-        fwrite(&files[i].log_count, sizeof(int), 1, fp);
-        for(int j = 0; j < files[i].log_count; j++){
-            LogEntry *log = &files[i].log_history[j];
-            int content_len = strlen(log->content);
-            int comment_len = strlen(log->comment);
-            int author_len = strlen(log->author_name);
+// CHECKOUT: a file a checkout writes. Pool workers compare and write the files, the calling thread reports
+// the outcome, so workers never print.
+typedef struct{
+    int id;                                    // file id
+    int unchanged;                             // incremental: the target already held the content
+    int error;                                 // errno of the step that failed, -1 for a name leaving the directory
+}CheckoutEntry;
 
-            fwrite(&content_len, sizeof(int), 1, fp);
-            fwrite(&comment_len, sizeof(int), 1, fp);
-            fwrite(&author_len, sizeof(int), 1, fp);
-            fwrite(log->content, sizeof(char), content_len, fp);
-            fwrite(log->comment, sizeof(char), comment_len, fp);
-            fwrite(log->author_name, sizeof(char), author_len, fp);
-            fwrite(&log->timestamp, sizeof(time_t), 1, fp);
-            fwrite(&log->version_id, sizeof(int), 1, fp);
-        }
+// LINE DIFF: one side of a diff, its text split into hashed lines
+typedef struct{
+    const char* text;                          // content being compared
+    size_t* start;                             // offset of each line, then the length of the text
+    uint64_t* hash;                            // hash of each line, the newline included
+    int* id;                                   // equal lines share an id, compared by the diff engine
+    char* changed;                             // lines that are not part of the common subsequence
+    long count;                                // number of lines
+}DiffSide;
 
-        fwrite(&files[i].is_deleted, sizeof(int), 1, fp);
-        fwrite(&files[i].front, sizeof(int), 1, fp);
-        fwrite(&files[i].rear, sizeof(int), 1, fp);
-    }
+// slot of the table giving equal lines equal ids
+typedef struct{
+    uint32_t check;                            // upper half of the line hash, compared before the lines
+    int32_t ref;                               // first line with this content (b follows a), -1 when free
+}DiffSlot;
 
-    for(int i = 0; i < snapshot_count; i++){
-        int tag_len = strlen(snapshots[i].tag);
-        fwrite(&tag_len, sizeof(int), 1, fp);
-        fwrite(snapshots[i].tag, sizeof(char), tag_len, fp);
-        fwrite(&snapshots[i].timestamp, sizeof(time_t), 1, fp);
-        fwrite(&snapshots[i].is_obsolete, sizeof(int), 1, fp);
-        fwrite(&snapshots[i].file_count, sizeof(int), 1, fp);
+// Myers search state: the two id sequences and the furthest reaching x per diagonal in both directions
+typedef struct{
+    const int* a;
+    const int* b;
+    long* fd;                                  // forward search, indexed by diagonal x - y
+    long* bd;                                  // backward search, indexed by diagonal x - y
+    char* ca;                                  // changed marks of a
+    char* cb;                                  // changed marks of b
+    long limit;                                // edit cost after which a split is taken as good enough
+}DiffSearch;
 
-        for(int j = 0; j < snapshots[i].file_count; j++){
-            File *file = &snapshots[i].files[j];
+// BENCHMARK PHASES: operations --bench times, one histogram each
+enum{
+    BENCH_ADD = 0,
+    BENCH_UPDATE,
+    BENCH_SNAPSHOT,
+    BENCH_VIEW,
+    BENCH_REVERT,
+    BENCH_ROLLBACK,
+    BENCH_ASOF,
+    BENCH_SAVE,
+    BENCH_LOAD,
+    BENCH_PHASES
+};
 
-            int name_len = strlen(file->name);
-            fwrite(&name_len, sizeof(int), 1, fp);
-            fwrite(file->name, sizeof(char), name_len, fp);
+// COMMAND STATISTICS: call count and latency histogram of one command, updated atomically
+typedef struct{
+    const char* name;                          // command word, "other" collects unknown commands
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[HIST_BUCKETS];            // log-linear: exact below 16 ns, then HIST_SUB_BITS per power of two
+}CommandStat;
 
-            fwrite(&file->log_count, sizeof(int), 1, fp);
-            for(int k = 0; k < file->log_count; k++){
-                LogEntry *log = &file->log_history[k];
-                int content_len = strlen(log->content);
-                int comment_len = strlen(log->comment);
-                int author_len = strlen(log->author_name);
+// I/O STATISTICS: system calls and bytes of the file system's own file access
+typedef struct{
+    uint64_t calls;
+    uint64_t bytes;
+}IoCounter;
 
-                fwrite(&content_len, sizeof(int), 1, fp);
-                fwrite(&comment_len, sizeof(int), 1, fp);
-                fwrite(&author_len, sizeof(int), 1, fp);
-                fwrite(log->content, sizeof(char), content_len, fp);
-                fwrite(log->comment, sizeof(char), comment_len, fp);
-                fwrite(log->author_name, sizeof(char), author_len, fp);
-                fwrite(&log->timestamp, sizeof(time_t), 1, fp);
-                fwrite(&log->version_id, sizeof(int), 1, fp);
-            }
+enum{
+    IO_OPEN = 0,
+    IO_READ,
+    IO_WRITE,
+    IO_MAP,                                    // bytes are the length mapped, pages are read on first use
+    IO_RENAME,
+    IO_SYNC,                                   // fsync of a written file or of the directory it was renamed in
+    IO_KINDS
+};
 
-            fwrite(&file->is_deleted, sizeof(int), 1, fp);
-            fwrite(&file->front, sizeof(int), 1, fp);
-            fwrite(&file->rear, sizeof(int), 1, fp);
-        }
-    }
+// MEMORY STATISTICS: what one part of the state holds, computed by walking it
+typedef struct{
+    const char* name;
+    const char* unit;                          // what count counts
+    uint64_t count;
+    uint64_t bytes;                            // heap bytes, the mapped state file is reported on its own
+}MemStat;
 
-    fclose(fp);
-    printf("Data successfully saved to %s\n", filename);
-}
+enum{
+    MEM_LIVE = 0,
+    MEM_SNAPSHOTS,
+    MEM_HISTORY,
+    MEM_NAMES,
+    MEM_SEARCH,
+    MEM_CACHE,
+    MEM_KINDS
+};
 
-// load the file system state from disk
-void load_from_disk(const char *filename){
-    FILE *fp = fopen(filename, "rb");
-    if(!fp){
-        perror("Error opening file for reading");
-        return;
-    }
+// SEARCH INDEX: trigram posting lists over every stored content, for grep
+// A content is indexed once as a document, known by the hash of its blob, whichever files, versions and
+// snapshots hold it; cold versions keep their hash, so they are found without reading the cold tier.
+// Documents are numbered in indexing order, which puts the versions of a file next to each other, so the
+// list of a trigram is kept as runs of consecutive documents and lists intersect by merging runs.
+typedef struct{
+    uint32_t first;                            // first document of the run
+    uint32_t count;                            // documents in the run
+}DocRun;
 
-    fread(&file_count, sizeof(int), 1, fp);
-    fread(&snapshot_count, sizeof(int), 1, fp);
+typedef struct{
+    DocRun* runs;                              // documents with the trigram, ascending; NULL while the position is free
+    uint32_t count;                            // number of entries in runs
+    uint32_t cap;                              // entries allocated in runs
+    uint32_t trigram;                          // three bytes of content, the first one highest
+}Posting;
 
-    files = (File *)malloc(file_count * sizeof(File));
+// GROWABLE BUFFER
+typedef struct{
+    char* data;                                // bytes written so far
+    size_t len;                                // number of bytes used
+    size_t cap;                                // number of bytes allocated
+}Buffer;
 
-    for(int i = 0; i < file_count; i++){
-        int name_len;
-        fread(&name_len, sizeof(int), 1, fp);
-        files[i].name = (char *)malloc(name_len + 1);
-        fread(files[i].name, sizeof(char), name_len, fp);
-        files[i].name[name_len] = '\0';
+// COMMAND STATUS: returned by every command, batch mode reports it after each command
+enum{
+    VFS_OK = 0,
+    VFS_NOT_FOUND,                             // no such file, snapshot or version
+    VFS_CONFLICT,                              // the file or snapshot is in a state the command does not apply to
+    VFS_INVALID,                               // malformed command or option value
+    VFS_IO                                     // a file could not be read or written
+};
 
-        fread(&files[i].log_count, sizeof(int), 1, fp);
-        for (int j = 0; j < files[i].log_count; j++) {
-            LogEntry *log = &files[i].log_history[j];
-            int content_len, comment_len, author_len;
+// JOURNAL RECORD TYPES: one per command that changes the file system
+// a record is: u32 length of the rest, u8 type, i64 timestamp, i32 number, then name, author and note as
+// u32 length + bytes, then the content as u64 length + bytes
+enum{
+    J_ADD = 1,
+    J_DELETE,
+    J_RECOVER,
+    J_REVERT,
+    J_SNAPSHOT,
+    J_ROLLBACK,
+    J_DELETESNAP,
+    J_OBSOLETESNAP,
+    J_RECOVERSNAP,
+    J_RETENTION,                               // 'set retention', its number is the new limit (0 for all)
+    J_HOT                                      // 'set hot', its number is the new count
+};
 
-            fread(&content_len, sizeof(int), 1, fp);
-            fread(&comment_len, sizeof(int), 1, fp);
-            fread(&author_len, sizeof(int), 1, fp);
+// STATE FILE LAYOUT: a header, fixed-size record tables, then a string and a blob data section.
+// Offsets are from the start of the file, so a mapped state file can be used in place.
+typedef struct{
+    char magic[4];                             // STATE_MAGIC
+    uint32_t name_count;                       // number of file ids
+    uint32_t snapshot_count;                   // number of snapshots
+    uint32_t blob_count;                       // number of blob records
+    uint64_t generation;                       // identifies this image to the journal written after it
+    uint32_t page_count;                       // number of distinct pages over all tables
+    uint32_t live_pages;                       // page references of the live table, they come first
+    uint64_t page_refs;                        // total page references, the live table's then each snapshot's
+    uint64_t file_records;                     // total file records, grouped by page
+    uint64_t log_records;                      // total log records
+    uint64_t blob_table;                       // offset of BlobRecord[blob_count]
+    uint64_t name_table;                       // offset of uint64_t[name_count], string offsets of the file names
+    uint64_t page_table;                       // offset of PageRecord[page_count]
+    uint64_t page_ref_table;                   // offset of int32_t[page_refs], -1 for an empty page
+    uint64_t file_table;                       // offset of FileRecord[file_records]
+    uint64_t log_table;                        // offset of LogRecord[log_records]
+    uint64_t cold_refs;                        // total cold references, grouped by file
+    uint64_t cold_ref_table;                   // offset of ColdRef[cold_refs], offsets within the cold section
+    uint64_t event_records;                    // total file events, grouped by file
+    uint64_t event_table;                      // offset of FileEvent[event_records]
+    uint64_t rollback_count;                   // number of rollbacks of the live tree
+    uint64_t rollback_table;                   // offset of RollbackRecord[rollback_count]
+    uint64_t cold_section;                     // offset of the cold tier records still referred to
+    uint64_t cold_size;                        // length of the cold section
+    uint64_t snapshot_table;                   // offset of SnapshotRecord[snapshot_count]
+    uint64_t string_section;                   // offset of the NUL terminated strings
+    uint64_t data_section;                     // offset of the blob data
+    uint64_t size;                             // total size of the state file
+    int32_t retention;                         // 'set retention' in force when the image was taken, 0 for all
+    int32_t hot_versions;                      // 'set hot' in force when the image was taken
+    uint32_t meta_crc;                         // CRC32C of the header up to here and of the file up to data_section
+    uint32_t cold_crc;                         // CRC32C of the cold section
+}StateHeader;
 
-            log->content = (char *)malloc(content_len + 1);
-            log->comment = (char *)malloc(comment_len + 1);
-            log->author_name = (char *)malloc(author_len + 1);
+typedef struct{
+    uint64_t hash;                             // content hash of the blob
+    uint64_t len;                              // full content length
+    uint64_t stored;                           // bytes of data (a NUL follows them in the file)
+    uint64_t data;                             // offset of the data within the data section
+    uint64_t raw;                              // bytes the data unpacks to
+    int32_t base_id;                           // blob the delta applies to, -1 for a keyframe
+    int32_t chunk_count;                       // when non-zero, data holds this many int32 chunk blob ids
+    int32_t codec;                             // codec the data is packed with
+    uint32_t crc;                              // CRC32C of the stored bytes of data
+}BlobRecord;
 
-            fread(log->content, sizeof(char), content_len, fp);
-            fread(log->comment, sizeof(char), comment_len, fp);
-            fread(log->author_name, sizeof(char), author_len, fp);
+typedef struct{
+    uint64_t first_file;                       // index of the first of file_count file records
+    int32_t file_count;
+    int32_t reserved;
+}PageRecord;
 
-            log->content[content_len] = '\0';
-            log->comment[comment_len] = '\0';
-            log->author_name[author_len] = '\0';
+typedef struct{
+    uint64_t first_log;                        // index of the first of log_count log records
+    uint64_t first_cold;                       // index of the first of cold_count cold references
+    uint64_t first_event;                      // index of the first of event_count file events
+    int32_t id;                                // file id, names the file and gives its slot in the page
+    int32_t log_count;                         // hot versions
+    int32_t cold_count;                        // cold versions, they come before the hot ones
+    int32_t is_deleted;
+    int32_t event_count;
+    int32_t reserved;
+}FileRecord;
 
-            fread(&log->timestamp, sizeof(time_t), 1, fp);
-            fread(&log->version_id, sizeof(int), 1, fp);
-        }
+typedef struct{
+    uint64_t comment;                          // offset of the comment within the string section
+    uint64_t author_name;                      // offset of the author within the string section
+    int64_t timestamp;
+    int32_t blob_id;                           // content of this version
+    int32_t version_id;
+}LogRecord;
 
-        fread(&files[i].is_deleted, sizeof(int), 1, fp);
-        fread(&files[i].front, sizeof(int), 1, fp);
-        fread(&files[i].rear, sizeof(int), 1, fp);
-    }
+typedef struct{
+    uint64_t tag;                              // offset of the tag within the string section
+    uint64_t first_page;                       // index of the first of page_count page references
+    int64_t timestamp;
+    int32_t page_count;
+    int32_t is_obsolete;
+}SnapshotRecord;
 
-    snapshots = (Snapshot *)malloc(snapshot_count * sizeof(Snapshot));
+typedef struct{
+    int64_t at;                                // time of the rollback
+    uint64_t first_page;                       // index of the first of page_count page references of the tree it replaced
+    int32_t page_count;
+    int32_t reserved;
+}RollbackRecord;
 
-    for(int i = 0; i < snapshot_count; i++){
-        int tag_len;
-        fread(&tag_len, sizeof(int), 1, fp);
-        snapshots[i].tag = (char *)malloc(tag_len + 1);
-        fread(snapshots[i].tag, sizeof(char), tag_len, fp);
-        snapshots[i].tag[tag_len] = '\0';
-
-        fread(&snapshots[i].timestamp, sizeof(time_t), 1, fp);
-        fread(&snapshots[i].is_obsolete, sizeof(int), 1, fp);
-        fread(&snapshots[i].file_count, sizeof(int), 1, fp);
-
-        snapshots[i].files = (File *)malloc(snapshots[i].file_count * sizeof(File));
-        for(int j = 0; j < snapshots[i].file_count; j++){
-            File *file = &snapshots[i].files[j];
-            int name_len;
-            fread(&name_len, sizeof(int), 1, fp);
-            file->name = (char *)malloc(name_len + 1);
-            fread(file->name, sizeof(char), name_len, fp);
-            file->name[name_len] = '\0';
-
-            fread(&file->log_count, sizeof(int), 1, fp);
-            for (int k = 0; k < file->log_count; k++) {
-                LogEntry *log = &file->log_history[k];
-                int content_len, comment_len, author_len;
-
-                fread(&content_len, sizeof(int), 1, fp);
-                fread(&comment_len, sizeof(int), 1, fp);
-                fread(&author_len, sizeof(int), 1, fp);
-
-                log->content = (char *)malloc(content_len + 1);
-                log->comment = (char *)malloc(comment_len + 1);
-                log->author_name = (char *)malloc(author_len + 1);
-
-                fread(log->content, sizeof(char), content_len, fp);
-                fread(log->comment, sizeof(char), comment_len, fp);
-                fread(log->author_name, sizeof(char), author_len, fp);
-
-                log->content[content_len] = '\0';
-                log->comment[comment_len] = '\0';
-                log->author_name[author_len] = '\0';
-
-                fread(&log->timestamp, sizeof(time_t), 1, fp);
-                fread(&log->version_id, sizeof(int), 1, fp);
-            }
-
-            fread(&file->is_deleted, sizeof(int), 1, fp);
-            fread(&file->front, sizeof(int), 1, fp);
-            fread(&file->rear, sizeof(int), 1, fp);
-        }
-    }
-
-    fclose(fp);
-    printf("Data successfully loaded from %s\n", filename);
-}
-
-// deleting the log for the file in FIFO manner
-void delete_log(const char *name){
-    for(int i=0; i<file_count; i++){
-        if(strcmp(files[i].name, name) == 0){
-            free(files[i].log_history[files[i].front].content);
-            free(files[i].log_history[files[i].front].author_name);
-            free(files[i].log_history[files[i].front].comment);
-            files[i].front = (files[i].front + 1)%MAX_LOG_ENTRIES;
-            files[i].log_count--;
-            printf("Deleted log of file %s using FIFO policy.\n", name); 
-            return;
-        }
-    }
-    printf("File %s not found.\n", name);  
+// PAGE LOAD: the tables of a mapped state file the worker pool builds pages from
+typedef struct{
+    const PageRecord* page_table;
+    const FileRecord* file_table;
+    const LogRecord* log_table;
+    const ColdRef* cold_table;
+    const FileEvent* event_table;
+    const char* strings;
+    Blob** ids;                                // blob id -> blob
+    FilePage** pages;                          // page id -> page being built
+}PageLoad;
+
+static FileTable *live = NULL;                  // files of the live file system, NULL while there are none
+static char **file_names = NULL;                // name of each file id, shared by every table
+static int name_count = 0;                      // number of file ids handed out
+static int name_cap = 0;                        // number of entries allocated in file_names
+static Arena name_arena = {NULL, 0};            // owns the file names that are not views into the state file
+static Snapshot *snapshots = NULL;              // stores all the snapshots created in snapshots array
+static int snapshot_count = 0;                  // keeps track of the number of snapshots created so far
+static Rollback *rollbacks = NULL;              // rollbacks of the live tree, in the order they were made
+static int rollback_count = 0;                  // number of entries in rollbacks
+static int is_change = 0;                       // tracks if there has been any change in the file system
+static Blob **blob_table = NULL;                // buckets of the content-addressed blob store
+static size_t blob_buckets = 0;                 // number of buckets in blob_table
+static size_t blob_count = 0;                   // number of distinct blobs stored
+static size_t blob_bytes = 0;                   // total content bytes represented by the blob store
+static size_t blob_stored = 0;                  // bytes actually held after delta encoding
+static int keyframe_interval = 8;               // versions per delta chain, keyframe included
+static int codec_choice = CODEC_AUTO;           // codec new blobs are packed with, set by 'set codec'
+static size_t cache_budget = CACHE_BUDGET;      // bytes the content cache may hold, set by 'set cache'
+static size_t cache_bytes = 0;                  // bytes held by the content cache, entries included
+static size_t cache_count = 0;                  // number of entries in the content cache
+static CacheEntry *cache_head = NULL;           // most recently used entry
+static CacheEntry *cache_tail = NULL;           // least recently used entry
+static uint64_t cache_hits = 0;                 // blob_get calls the cache answered
+static uint64_t cache_misses = 0;               // blob_get calls that had to build the content
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;  // guards the cache, daemon readers share it
+static int hot_versions = 4;                    // versions per file kept in memory, set by 'set hot'
+static int retention = 0;                       // versions per file kept at all, 0 for every one, set by 'set retention'
+static int cold_fd = -1;                        // unlinked spill file of the cold tier, created on first use
+static uint64_t cold_spilled = 0;               // bytes written to cold_fd since the last load
+static const char *cold_mapped = NULL;          // cold section of the mapped state file
+static uint64_t cold_mapped_len = 0;            // length of cold_mapped
+static __thread FILE *cmd_out = NULL;           // stream command output is written to, per thread
+static __thread FILE *cmd_err = NULL;           // stream command errors are written to, per thread
+static char *state_map = NULL;                  // mapping of the last loaded state file
+static size_t state_map_len = 0;                // length of state_map
+static int journal_mode = 0;                    // whether saves append to a journal instead of rewriting the state
+static char *journal_base = NULL;               // state file the journal currently extends, if any
+static size_t journal_base_size = 0;            // size of journal_base when it was written
+static size_t journal_size = 0;                 // bytes already in journal_base's journal
+static Buffer journal = {NULL, 0, 0};           // records of the changes made since the last save
+static int replaying = 0;                       // set while journal records are being applied
+static pid_t bgsave_pid = -1;                   // child writing a background save, -1 when none runs
+static char *bgsave_target = NULL;              // state file the background save writes
+static uint64_t bgsave_generation = 0;          // generation of the image it writes
+static size_t bgsave_journal = 0;               // journal bytes recorded before the fork, which the image holds
+static time_t replay_time = 0;                  // timestamp of the record being replayed
+static time_t fixed_time = 0;                   // set by the benchmark: the time changes are stamped with, 0 for the clock
+static NameIndex file_index = {NULL, 0, 0};     // file name -> file id
+static NameIndex snapshot_names = {NULL, 0, 0}; // snapshot tag -> slot in snapshots
+static int search_ready = 0;                    // whether the search index covers every stored content, built on the first grep
+static Posting *search_postings = NULL;         // probe table of posting lists by trigram, a power of two in size
+static size_t search_cap = 0;                   // number of positions in search_postings
+static size_t search_used = 0;                  // number of occupied positions
+static uint64_t *search_docs = NULL;            // content hash of each document
+static uint32_t search_doc_count = 0;           // number of documents indexed
+static uint32_t search_doc_cap = 0;             // entries allocated in search_docs
+static NameIndex search_index = {NULL, 0, 0};   // content hash -> document
+static uint64_t *search_seen = NULL;            // one bit per trigram, marks those already found in a text
+static __thread int shared_reader = 0;          // daemon: set while the thread runs a command under the shared lock
+static int worker_count = 0;                    // threads parallel work is split over, 0 until first needed
+static pthread_t *pool_threads = NULL;          // the worker_count - 1 threads helping the main thread
+static int pool_started = 0;                    // number of threads in pool_threads
+static int pool_quit = 0;                       // tells the pool threads to exit
+static PoolJob pool_job;                        // job the pool is working on
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_wake = PTHREAD_COND_INITIALIZER;  // a job was posted or the pool is stopping
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;  // the last pool thread left the job
+static pthread_rwlock_t state_lock = PTHREAD_RWLOCK_INITIALIZER;  // daemon: shared for reads, exclusive for changes
+static int serve_socket = -1;                   // daemon: listening socket, -1 when not serving
+static int stats_enabled = 1;                   // whether commands are timed, set by 'set stats'
+static int verify_content = 0;                  // whether a load checks the cold section and content checksums too, set by 'set verify'
+static CommandStat command_stats[] = {           // one per command word, the last one collects the rest
+    {.name = "add"}, {.name = "import"}, {.name = "viewfs"}, {.name = "view"}, {.name = "delete"}, {.name = "recover"},
+    {.name = "log"}, {.name = "snapshot"}, {.name = "rollback"}, {.name = "deletesnap"}, {.name = "obsoletesnap"},
+    {.name = "recoversnap"}, {.name = "listsnap"}, {.name = "revert"}, {.name = "diff"}, {.name = "diffsnap"},
+    {.name = "checkout"}, {.name = "grep"}, {.name = "save"}, {.name = "bgsave"}, {.name = "load"}, {.name = "verify"},
+    {.name = "set"}, {.name = "stats"}, {.name = "help"}, {.name = "other"}
+};
+static IoCounter io_stats[IO_KINDS];            // file system I/O since start, updated atomically
+static const char *io_names[IO_KINDS] = {"open", "read", "write", "map", "rename", "sync"};
+static __thread Buffer *dead_blobs = NULL;      // set in pool jobs: blobs whose last reference the job dropped
+static Buffer pool_dead = {NULL, 0, 0};         // dead blobs handed back by pool jobs, freed by the main thread
+
+// whether a pointer is a view into the mapped state file rather than a heap allocation
+static int is_mapped(const void *p){
+    return state_map && (const char *)p >= state_map && (const char *)p < state_map + state_map_len;
 }
 
-// adding a new file in the file system
-void add_file(const char *name, const char *file_name, const char *author_name, const char *note){
-    int fd = open(file_name, O_RDONLY);
-    if(fd == -1){
-        fprintf(stderr, "Error: File could not be opened.\n");
-        return;
-    }
-    char* content = malloc(MAX_BUFFSIZE);
-    if(content == NULL){
-        fprintf(stderr, "Error: Memory allocation for file content failed.\n");
-        close(fd);
-        return;
-    }
-    ssize_t bytes_read = read(fd, content, MAX_BUFFSIZE);
-    if(bytes_read == -1){
-        fprintf(stderr, "Error: File couldn't be read.\n");
-        free(content);
-        close(fd);
-        return;
-    }
-    content[bytes_read] = '\0';
-    LogEntry new_log;
-    new_log.content = strdup(content);
-    new_log.comment = strdup(note);
-    new_log.author_name = strdup(author_name);
-    new_log.timestamp = time(NULL);
-    close(fd);
-    free(content);
-    for(int i=0; i<file_count; i++){
-        if(strcmp(files[i].name, name) == 0){
-            if(files[i].is_deleted){
-                fprintf(stderr, "Error: Failed to update. File %s already exists and currently unavailable.\n", name);
-                return;
-            }
-            if(files[i].log_count >= MAX_LOG_ENTRIES){
-                delete_log(name);
-            }
-            new_log.version_id = files[i].log_count + 1;
-            files[i].rear = (files[i].rear + 1)%MAX_LOG_ENTRIES;
-            files[i].log_count++;
-            files[i].log_history[files[i].rear] = new_log;
-            is_change = 1;
-            printf("File %s updated successfully.\n", name);
-            return;
+// hands out size bytes from the arena, 8-byte aligned
+static void* arena_alloc(Arena *arena, size_t size){
+    size = (size + 7) & ~(size_t)7;
+    ArenaBlock *block = arena->head;
+    if(!block || block->cap - block->used < size){
+        size_t cap = block ? block->cap * 2 : ARENA_BLOCK;
+        if(cap > ARENA_BLOCK_MAX) cap = ARENA_BLOCK_MAX;
+        if(cap < size) cap = size;
+        block = malloc(sizeof(ArenaBlock) + cap);
+        if(!block){
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(EXIT_FAILURE);
         }
+        block->next = arena->head;
+        block->used = 0;
+        block->cap = cap;
+        arena->head = block;
     }
-    files = realloc(files, (file_count + 1)*sizeof(File));
-    if(!files){
-        perror("Error: Memory allocation failed.\n");  
-        exit(EXIT_FAILURE);
-    }
-    files[file_count].name = strdup(name);
-    files[file_count].log_history[0] = new_log;
-    files[file_count].log_history[0].version_id = 1;
-    files[file_count].log_count = 1;
-    files[file_count].is_deleted = 0;
-    files[file_count].front = 0;
-    files[file_count].rear = 0;
-    file_count++;
-    is_change = 1;
-    printf("File %s added successfully.\n", name);
+    void *p = block->data + block->used;
+    block->used += size;
+    arena->bytes += size;
+    return p;
 }
 
-// prints the current state of the file system
-void view_fileSystem(){
-    for(int i=0; i<file_count; i++){
-        if(!files[i].is_deleted){
-            printf("File name:     %s\n", files[i].name);
-        }
+// copies a string into the arena
+static char* arena_strdup(Arena *arena, const char *str){
+    size_t len = strlen(str) + 1;
+    return memcpy(arena_alloc(arena, len), str, len);
+}
+
+// releases everything the arena handed out
+static void arena_release(Arena *arena){
+    ArenaBlock *block = arena->head;
+    while(block){
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
     }
+    arena->head = NULL;
+    arena->bytes = 0;
 }
 
-// read the file content
-void view_fileContent(const char* filename){
-    for(int i=0; i<file_count; i++){
-        if(strcmp(files[i].name, filename) == 0){
-            if(files[i].is_deleted){
-                fprintf(stderr, "Error: File '%s' is currently unavailable. Use 'recover' to restore.\n", filename);
-                return;
-            }
-            printf("%s\n\n", files[i].log_history[files[i].rear].content);
-            return;
+// appends bytes to a growable buffer and returns the offset they were written at
+static size_t buffer_append(Buffer *buf, const void *data, size_t len){
+    if(len == 0) return buf->len;
+    if(buf->len + len > buf->cap){
+        size_t cap = buf->cap ? buf->cap : 4096;
+        while(buf->len + len > cap) cap *= 2;
+        buf->data = realloc(buf->data, cap);
+        if(!buf->data){
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(EXIT_FAILURE);
         }
+        buf->cap = cap;
     }
-    printf("File not found.\n");
-    return;
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    return buf->len - len;
 }
 
-// taking snapshot at the current time instance
-void create_snapshot(const char *tag){ 
-    if(!is_change){
-        printf("Already the latest file system version.\n");
-        return;
-    }
-    for(int i=0; i<snapshot_count; i++){
-        if(strcmp(snapshots[i].tag, tag) == 0){
-            fprintf(stderr, "Error: Snapshot with tag '%s' already exists\n", tag);   
-            return;
+// reports a failed system call like perror, on the command's error stream
+static void print_errno(const char *what){
+    fprintf(cmd_err, "%s: %s\n", what, strerror(errno));
+}
+
+// monotonic clock in nanoseconds
+static uint64_t clock_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// counts a system call of the given kind moving bytes bytes
+static void io_count(int kind, uint64_t bytes){
+    __atomic_add_fetch(&io_stats[kind].calls, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&io_stats[kind].bytes, bytes, __ATOMIC_RELAXED);
+}
+
+// opens a file, counting the call
+static int io_open(const char *path, int flags, mode_t mode){
+    int fd = open(path, flags, mode);
+    if(fd != -1) io_count(IO_OPEN, 0);
+    return fd;
+}
+
+// reads from a file, counting the call and the bytes read
+static ssize_t io_read(int fd, void *buf, size_t len){
+    ssize_t n = read(fd, buf, len);
+    if(n >= 0) io_count(IO_READ, n);
+    return n;
+}
+
+// writes to a file, counting the call and the bytes written
+static ssize_t io_write(int fd, const void *buf, size_t len){
+    ssize_t n = write(fd, buf, len);
+    if(n >= 0) io_count(IO_WRITE, n);
+    return n;
+}
+
+// maps a file read-only, counting the call and the length mapped
+static void* io_map(int fd, size_t len){
+    void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map != MAP_FAILED) io_count(IO_MAP, len);
+    return map;
+}
+
+// flushes a file's data to disk, counting the call
+static int io_sync(int fd){
+    int result = fsync(fd);
+    if(result == 0) io_count(IO_SYNC, 0);
+    return result;
+}
+
+// renames a file, counting the call; the directory is synced too so the new name survives a crash
+static int io_rename(const char *from, const char *to){
+    int result = rename(from, to);
+    if(result != 0) return result;
+    io_count(IO_RENAME, 0);
+    char dir[4096];
+    const char *slash = strrchr(to, '/');
+    snprintf(dir, sizeof(dir), "%.*s", slash ? (int)(slash - to) + 1 : 1, slash ? to : ".");
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if(fd == -1) return 0;
+    io_count(IO_OPEN, 0);
+    result = io_sync(fd);
+    close(fd);
+    return result;
+}
+
+// write function of the streams io_fopen returns: one counted write(2) per flushed buffer
+static ssize_t io_stream_write(void *cookie, const char *data, size_t len){
+    size_t done = 0;
+    while(done < len){
+        ssize_t n = write((int)(intptr_t)cookie, data + done, len - done);
+        if(n < 0){
+            if(errno == EINTR) continue;
+            return done ? (ssize_t)done : -1;
         }
+        io_count(IO_WRITE, n);
+        done += n;
     }
-    snapshots = realloc(snapshots, (snapshot_count + 1)*sizeof(Snapshot));
-    if (!snapshots) {
-        fprintf(stderr, "Error: Memory allocation failed\n");
-        
-        exit(EXIT_FAILURE);
+    return done;
+}
+
+// seek function of the streams io_fopen returns, so a header can be rewritten once what follows it is known
+static int io_stream_seek(void *cookie, off64_t *offset, int whence){
+    off_t pos = lseek((int)(intptr_t)cookie, *offset, whence);
+    if(pos < 0) return -1;
+    *offset = pos;
+    return 0;
+}
+
+// close function of the streams io_fopen returns: the file is synced first, so a save that reported
+// success is on disk
+static int io_stream_close(void *cookie){
+    int fd = (int)(intptr_t)cookie;
+    int failed = io_sync(fd) != 0;
+    if(close(fd) != 0) failed = 1;
+    return failed ? -1 : 0;
+}
+
+// opens a file for writing ("wb" truncates, "ab" appends) as a stream whose system calls are counted
+static FILE* io_fopen(const char *path, const char *mode){
+    int flags = O_WRONLY | O_CREAT | (mode[0] == 'a' ? O_APPEND : O_TRUNC);
+    int fd = io_open(path, flags, 0644);
+    if(fd == -1) return NULL;
+    cookie_io_functions_t functions = {NULL, io_stream_write, io_stream_seek, io_stream_close};
+    FILE *fp = fopencookie((void *)(intptr_t)fd, "w", functions);
+    if(!fp) close(fd);
+    return fp;
+}
+
+// histogram bucket of a latency: the value itself below 16 ns, then the power of two and the next
+// HIST_SUB_BITS bits below its top bit
+static int hist_bucket(uint64_t ns){
+    if(ns < (1u << HIST_SUB_BITS)) return (int)ns;
+    int msb = 63 - __builtin_clzll(ns);
+    return (msb - HIST_SUB_BITS + 1) << HIST_SUB_BITS | (int)((ns >> (msb - HIST_SUB_BITS)) & ((1u << HIST_SUB_BITS) - 1));
+}
+
+// largest latency that falls into a histogram bucket
+static uint64_t hist_value(int bucket){
+    if(bucket < (1 << HIST_SUB_BITS)) return bucket;
+    int msb = (bucket >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+    uint64_t low = (uint64_t)((1 << HIST_SUB_BITS) | (bucket & ((1 << HIST_SUB_BITS) - 1))) << (msb - HIST_SUB_BITS);
+    return low + ((uint64_t)1 << (msb - HIST_SUB_BITS)) - 1;
+}
+
+// statistics slot of a command word
+static CommandStat* command_stat(const char *name){
+    int count = sizeof(command_stats) / sizeof(command_stats[0]);
+    for(int i = 0; i < count - 1; i++){
+        if(command_stats[i].name[0] == name[0] && strcmp(command_stats[i].name, name) == 0) return &command_stats[i];
     }
-    Snapshot *snapshot = &snapshots[snapshot_count++];
-    snapshot->files = malloc(file_count*sizeof(File));
-    snapshot->file_count = file_count;
-    snapshot->timestamp = time(NULL);
-    snapshot->tag = strdup(tag);
-    snapshot->is_obsolete = 0;
+    return &command_stats[count - 1];
+}
 
-    for(int i=0; i<file_count; i++){
-        if(files[i].is_deleted) continue;
-        snapshot->files[i].name = strdup(files[i].name);
-        snapshot->files[i].log_count = files[i].log_count;
-        snapshot->files[i].is_deleted = files[i].is_deleted;
-        snapshot->files[i].rear = files[i].rear;
-        snapshot->files[i].front = files[i].front;
+// adds one call taking ns nanoseconds to a command's statistics
+static void stats_record(CommandStat *stat, uint64_t ns){
+    __atomic_add_fetch(&stat->count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stat->total_ns, ns, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stat->buckets[hist_bucket(ns)], 1, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&stat->max_ns, __ATOMIC_RELAXED);
+    while(ns > max && !__atomic_compare_exchange_n(&stat->max_ns, &max, ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
 
-        for(int j=0; j<files[i].log_count; j++){
-            snapshot->files[i].log_history[j].comment = strdup(files[i].log_history[j].comment);
-            snapshot->files[i].log_history[j].author_name = strdup(files[i].log_history[j].author_name);
-            snapshot->files[i].log_history[j].timestamp = files[i].log_history[j].timestamp;
-            snapshot->files[i].log_history[j].version_id = files[i].log_history[j].version_id;
-            snapshot->files[i].log_history[j].content = strdup(files[i].log_history[j].content);
+// latency below which the given fraction of a command's calls finished
+static uint64_t stats_percentile(const CommandStat *stat, double fraction){
+    uint64_t count = __atomic_load_n(&stat->count, __ATOMIC_RELAXED);
+    uint64_t rank = (uint64_t)(fraction * count + 0.5), seen = 0;
+    if(rank < 1) rank = 1;
+    for(int b = 0; b < HIST_BUCKETS; b++){
+        seen += __atomic_load_n(&stat->buckets[b], __ATOMIC_RELAXED);
+        if(seen >= rank){
+            uint64_t value = hist_value(b), max = __atomic_load_n(&stat->max_ns, __ATOMIC_RELAXED);
+            return value < max ? value : max;
         }
     }
-    is_change = 0;
-    printf("Snapshot '%s' created successfully.\n", tag);
+    return __atomic_load_n(&stat->max_ns, __ATOMIC_RELAXED);
 }
 
-//  reverts the file system to a specified snapshot based on its index
-void rollback(int snapshot_index){
-    if(snapshot_index < 0 || snapshot_index >= snapshot_count){
-        fprintf(stderr, "Error: Invalid snapshot index\n");
-        return;
+// claims and processes items of the posted job until none are left
+static void pool_run(){
+    for(;;){
+        int begin = __atomic_fetch_add(&pool_job.next, POOL_GRAIN, __ATOMIC_RELAXED);
+        if(begin >= pool_job.count) return;
+        int end = begin + POOL_GRAIN < pool_job.count ? begin + POOL_GRAIN : pool_job.count;
+        pool_job.fn(pool_job.ctx, begin, end);
     }
+}
 
-    if(snapshots[snapshot_index].is_obsolete){
-        fprintf(stderr, "Error: Referred snapshot index %d is obsolete\n", snapshot_index);
-        return;
+// body of a pool thread: sleeps until a job is posted and helps with it
+static void* pool_thread(void *arg){
+    unsigned long seen = (unsigned long)(uintptr_t)arg;
+    pthread_mutex_lock(&pool_lock);
+    for(;;){
+        while(!pool_quit && pool_job.generation == seen) pthread_cond_wait(&pool_wake, &pool_lock);
+        if(pool_quit) break;
+        seen = pool_job.generation;
+        pthread_mutex_unlock(&pool_lock);
+        pool_run();
+        pthread_mutex_lock(&pool_lock);
+        if(--pool_job.active == 0) pthread_cond_signal(&pool_done);
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return NULL;
+}
+
+// stops and joins the pool threads
+static void pool_stop(){
+    pthread_mutex_lock(&pool_lock);
+    pool_quit = 1;
+    pthread_cond_broadcast(&pool_wake);
+    pthread_mutex_unlock(&pool_lock);
+    for(int i = 0; i < pool_started; i++){
+        pthread_join(pool_threads[i], NULL);
     }
+    free(pool_threads);
+    pool_threads = NULL;
+    pool_started = 0;
+    pool_quit = 0;
+}
 
-    for(int i = 0; i < file_count; i++){
-        free(files[i].name);
-        for(int j = 0; j < files[i].log_count; j++){
-            free(files[i].log_history[j].content);
-            free(files[i].log_history[j].author_name);
-            free(files[i].log_history[j].comment);
-        }
+// starts the pool threads, one per online CPU unless 'set workers' chose a count
+static void pool_start(){
+    if(worker_count == 0){
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        worker_count = cpus < 1 ? 1 : cpus > MAX_WORKERS ? MAX_WORKERS : (int)cpus;
     }
-    free(files);
-    Snapshot *snapshot = &snapshots[snapshot_index];
-    file_count = snapshot->file_count;
-    files = malloc(file_count * sizeof(File));
-    if(!files){
+    if(pool_started || worker_count == 1) return;
+    pool_threads = malloc((worker_count - 1) * sizeof(pthread_t));
+    if(!pool_threads){
         fprintf(stderr, "Error: Memory allocation failed\n");
         exit(EXIT_FAILURE);
     }
-
-    for(int i = 0; i < file_count; i++){
-        File *src = &snapshot->files[i];
-        File *dst = &files[i];
-        dst->name = strdup(src->name);
-        dst->is_deleted = src->is_deleted;
-        dst->log_count = src->log_count;
-        dst->front = src->front;
-        dst->rear = src->rear;
-        for(int j = 0; j < src->log_count; j++){
-            dst->log_history[j].author_name = strdup(src->log_history[j].author_name);
-            dst->log_history[j].comment = strdup(src->log_history[j].comment);
-            dst->log_history[j].content = strdup(src->log_history[j].content);
-            dst->log_history[j].timestamp = src->log_history[j].timestamp;
-            dst->log_history[j].version_id = src->log_history[j].version_id;
-        }
+    for(int i = 0; i < worker_count - 1; i++){
+        if(pthread_create(&pool_threads[i], NULL, pool_thread, (void *)(uintptr_t)pool_job.generation) != 0) break;
+        pool_started++;
     }
-
-    printf("Rolled back to snapshot index %d successfully.\n", snapshot_index);
 }
 
-// recover back the obsolete snapshot
-void recover_snapshot(int snapshot_index){
-    if(snapshot_index < 0 || snapshot_index >= snapshot_count){
-        fprintf(stderr, "Error: Invalid snapshot index\n");
+// runs fn over items 0..count-1, split between the pool threads and the caller; returns once all are done
+static void parallel_for(int count, void (*fn)(void *ctx, int begin, int end), void *ctx){
+    pool_start();
+    if(pool_started == 0 || count <= POOL_GRAIN){
+        if(count > 0) fn(ctx, 0, count);
         return;
     }
+    pthread_mutex_lock(&pool_lock);
+    pool_job.fn = fn;
+    pool_job.ctx = ctx;
+    pool_job.count = count;
+    pool_job.next = 0;
+    pool_job.active = pool_started;
+    pool_job.generation++;
+    pthread_cond_broadcast(&pool_wake);
+    pthread_mutex_unlock(&pool_lock);
+    pool_run();
+    pthread_mutex_lock(&pool_lock);
+    while(pool_job.active > 0) pthread_cond_wait(&pool_done, &pool_lock);
+    pthread_mutex_unlock(&pool_lock);
+}
 
-    if(!snapshots[snapshot_index].is_obsolete){
-        fprintf(stderr, "Snapshot %d is already Active\n", snapshot_index);
-        return;
+// current time, or the time of the journal record being replayed
+static time_t now(){
+    return replaying ? replay_time : fixed_time ? fixed_time : time(NULL);
+}
+
+// appends a length-prefixed string (NULL counts as empty) to a journal record
+static void journal_string(const char *str){
+    uint32_t len = str ? strlen(str) : 0;
+    buffer_append(&journal, &len, sizeof(len));
+    buffer_append(&journal, str, len);
+}
+
+// records a change to the file system so the next save can append it to the journal
+static void journal_append(int type, int num, const char *name, const char *author, const char *note, const char *data, uint64_t len){
+    if(!journal_mode || replaying) return;
+    size_t start = journal.len;
+    uint32_t rec_len = 0;
+    uint8_t rec_type = type;
+    int64_t timestamp = now();
+    int32_t number = num;
+    buffer_append(&journal, &rec_len, sizeof(rec_len));
+    buffer_append(&journal, &rec_type, sizeof(rec_type));
+    buffer_append(&journal, &timestamp, sizeof(timestamp));
+    buffer_append(&journal, &number, sizeof(number));
+    journal_string(name);
+    journal_string(author);
+    journal_string(note);
+    buffer_append(&journal, &len, sizeof(len));
+    buffer_append(&journal, data, len);
+    rec_len = journal.len - start - sizeof(rec_len);
+    memcpy(journal.data + start, &rec_len, sizeof(rec_len));
+}
+
+// 64-bit hash of a byte range, consumed a word at a time
+static uint64_t hash_bytes(const void *data, size_t len){
+    const unsigned char *p = data;
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ (len * 0xff51afd7ed558ccdULL);
+    while(len >= 8){
+        uint64_t w;
+        memcpy(&w, p, 8);
+        h = (h ^ (w * 0xc4ceb9fe1a85ec53ULL)) * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 29;
+        p += 8;
+        len -= 8;
     }
-    
-    snapshots[snapshot_index].is_obsolete = 0;
-    printf("Snapshot %d is successfully recovered\n", snapshot_index);
-    return;
+    uint64_t w = 0;
+    memcpy(&w, p, len);
+    h = (h ^ (w * 0xc4ceb9fe1a85ec53ULL)) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 32;
+    return h;
 }
 
-// delete file from the file system
-void delete_file(const char *name){
-    for(int i=0; i<file_count; i++){
-        if(strcmp(files[i].name, name) == 0 && !files[i].is_deleted){
-            files[i].is_deleted = 1;
-            is_change = 1;
-            printf("File %s deleted successfully.\n", name);
-            
-            return;
-        }
+// product of two polynomials modulo the CRC32C polynomial, bit-reflected like the CRC itself
+static uint32_t crc32c_mul(uint32_t a, uint32_t b){
+    uint32_t product = 0;
+    for(uint32_t m = 1u << 31; m; m >>= 1){
+        if(a & m) product ^= b;
+        b = b & 1 ? (b >> 1) ^ CRC_POLY : b >> 1;
     }
-    printf("File %s not found.\n", name);  
+    return product;
 }
 
-// recover a deleted file by its name
-void recover_file(const char *name){
-    for(int i=0; i<file_count; i++){
-        if(strcmp(files[i].name, name) == 0 && files[i].is_deleted){
-            files[i].is_deleted = 0;
-            is_change = 1;
-            printf("File %s recovered successfully.\n", name);
-            return;
-        }
+// x^(8 * len) modulo the CRC32C polynomial: multiplying a CRC by it appends len zero bytes
+static uint32_t crc32c_zeros(uint64_t len){
+    uint32_t result = 1u << 31, power = 1u << 23;
+    for(; len; len >>= 1){
+        if(len & 1) result = crc32c_mul(power, result);
+        power = crc32c_mul(power, power);
     }
-    
-    printf("File %s not found or not deleted.\n", name);
+    return result;
 }
 
-// revert file to a specific version
-void revert_file(const char *name, int version){
-    for(int i=0; i<file_count; i++){
-        if(strcmp(files[i].name, name) == 0){
-            if(files[i].is_deleted){
-                fprintf(stderr, "Error: Cannot revert. The file '%s' is currently deleted. Please recover it first.\n", name);
-            return;
-            }
-            if(version < 1 || version > files[i].log_count){
-                fprintf(stderr, "Version is out of bounds.\n");
-                return;
-            }
-            int idx = (files[i].front + version - 1) % MAX_LOG_ENTRIES;
-            LogEntry temp = files[i].log_history[files[i].rear];
-            files[i].log_history[files[i].rear] = files[i].log_history[idx];
-            files[i].log_history[idx] = temp;
+static uint32_t crc_table[8][256];                // slicing-by-8 tables of the software CRC32C
+static uint32_t crc_lane_zeros;                   // crc32c_zeros(CRC_LANE), joins the lanes of the hardware CRC
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
 
-            printf("File content successfully reverted to version %d.\n", version);
-            return;
-        }
+// fills the CRC32C tables, once per process
+static void crc32c_init(){
+    for(uint32_t n = 0; n < 256; n++){
+        uint32_t c = n;
+        for(int k = 0; k < 8; k++) c = c & 1 ? (c >> 1) ^ CRC_POLY : c >> 1;
+        crc_table[0][n] = c;
     }
-    printf("No history found for the file: %s\n", name);   
+    for(int t = 1; t < 8; t++){
+        for(int n = 0; n < 256; n++) crc_table[t][n] = (crc_table[t - 1][n] >> 8) ^ crc_table[0][crc_table[t - 1][n] & 0xff];
+    }
+    crc_lane_zeros = crc32c_zeros(CRC_LANE);
 }
 
-// delete snapshot based on the tag
-void delete_snapshot(const char* tag) {
-    int found = 0;
-    for(int i = 0; i < snapshot_count; i++){
-        if(strcmp(snapshots[i].tag, tag) == 0){
-            found = 1;
-            for(int j = 0; j < snapshots[i].file_count; j++){
-                File *file = &snapshots[i].files[j];
-                free(file->name);
-                for(int k = 0; k < file->log_count; k++){
-                    free(file->log_history[k].content);
-                    free(file->log_history[k].comment);
-                    free(file->log_history[k].author_name);
-                }
-            }
-            free(snapshots[i].files);
-            for(int j = i; j < snapshot_count - 1; j++){
-                snapshots[j] = snapshots[j + 1];
-            }
-            snapshot_count--;
-            printf("Snapshot with tag '%s' deleted successfully.\n", tag);
-            break;
-        }
-    }
-    if(!found){
-        printf("Snapshot not found for the tag '%s'.\n", tag);
+// software CRC32C, eight bytes per step
+static uint32_t crc32c_soft(uint32_t crc, const unsigned char *p, size_t len){
+    for(; len >= 8; p += 8, len -= 8){
+        uint64_t w;
+        memcpy(&w, p, 8);
+        w ^= crc;
+        crc = crc_table[7][w & 0xff] ^ crc_table[6][(w >> 8) & 0xff] ^ crc_table[5][(w >> 16) & 0xff]
+            ^ crc_table[4][(w >> 24) & 0xff] ^ crc_table[3][(w >> 32) & 0xff] ^ crc_table[2][(w >> 40) & 0xff]
+            ^ crc_table[1][(w >> 48) & 0xff] ^ crc_table[0][w >> 56];
     }
+    while(len--) crc = (crc >> 8) ^ crc_table[0][(crc ^ *p++) & 0xff];
+    return crc;
 }
 
-// obsoleting snapshot based on the tag for audit purposes
-void obsolete_snapshot(const char* tag){
-    int found = 0;
-    for(int i=0; i<snapshot_count; i++){
-        if(strcmp(snapshots[i].tag, tag) == 0){
-            found = 1;
-            snapshots[i].is_obsolete = 1;
-            printf("Snapshot with tag '%s' deleted successfully.\n", tag);
-            break;
+#ifdef __x86_64__
+// SSE4.2 CRC32C: three lanes of CRC_LANE bytes are summed at once, hiding the latency of the crc32
+// instruction, and joined by shifting the earlier lanes over the later ones
+__attribute__((target("sse4.2"))) static uint32_t crc32c_hard(uint32_t crc, const unsigned char *p, size_t len){
+    uint64_t c0 = crc;
+    for(; len >= 3 * CRC_LANE; p += 3 * CRC_LANE, len -= 3 * CRC_LANE){
+        uint64_t c1 = 0, c2 = 0, w0, w1, w2;
+        for(size_t i = 0; i < CRC_LANE; i += 8){
+            memcpy(&w0, p + i, 8);
+            memcpy(&w1, p + CRC_LANE + i, 8);
+            memcpy(&w2, p + 2 * CRC_LANE + i, 8);
+            c0 = _mm_crc32_u64(c0, w0);
+            c1 = _mm_crc32_u64(c1, w1);
+            c2 = _mm_crc32_u64(c2, w2);
         }
+        c0 = crc32c_mul(crc_lane_zeros, crc32c_mul(crc_lane_zeros, (uint32_t)c0) ^ (uint32_t)c1) ^ (uint32_t)c2;
     }
-    if(!found){
-        printf("Snapshot not found for the tag '%s'.\n", tag);
+    for(uint64_t w; len >= 8; p += 8, len -= 8){
+        memcpy(&w, p, 8);
+        c0 = _mm_crc32_u64(c0, w);
     }
+    uint32_t c = (uint32_t)c0;
+    while(len--) c = _mm_crc32_u8(c, *p++);
+    return c;
 }
+#endif
 
-// lists all the snapshots that have been created
-void list_snapshots(){
-    printf("Available Snapshots:\n");
-    for (int i = 0; i < snapshot_count; i++){
-        char *time_str = ctime(&snapshots[i].timestamp);
-        time_str[strlen(time_str) - 1] = '\0';        
-        printf("Snapshot %d: %s, Timestamp: %s, Status: %s\n", i, snapshots[i].tag, time_str, snapshots[i].is_obsolete ? "Deleted" : "Active");
-    }  
+// CRC32C of a byte range, with the crc32 instruction when the CPU has it
+static uint32_t crc32c(const void *data, size_t len){
+    pthread_once(&crc_once, crc32c_init);
+#ifdef __x86_64__
+    if(__builtin_cpu_supports("sse4.2")) return ~crc32c_hard(~0u, data, len);
+#endif
+    return ~crc32c_soft(~0u, data, len);
 }
 
-// log history for a file
-void log_history(const char *name){
-    for(int i=0; i<file_count; i++){
-        if(strcmp(files[i].name, name) == 0){
-            printf("Log History for %s:\n", name);
-            if(files[i].is_deleted){
-                printf("Note: This file is currently deleted.\n");
-            }
-            int idx = files[i].front;
-            int count = files[i].log_count;
-            while(count > 0){
-                printf("Author: %s\n", files[i].log_history[idx].author_name);
-                printf("Note: %s\n", files[i].log_history[idx].comment);
-                printf("Timestamp: %s\n", ctime(&files[i].log_history[idx].timestamp));
-                printf("Version: %d\n", files[i].log_history[idx].version_id);
-                printf("-----------------------------\n");
-                idx = (idx + 1) % MAX_LOG_ENTRIES;
-                count--;
-            }
-            return;
+// CRC32C of a range made of two parts, from the CRCs of the parts
+static uint32_t crc32c_combine(uint32_t first, uint32_t second, uint64_t second_len){
+    return crc32c_mul(crc32c_zeros(second_len), first) ^ second;
+}
+
+// doubles the number of buckets once the store gets crowded
+static void blob_table_grow(){
+    size_t new_buckets = blob_buckets ? blob_buckets * 2 : 1024;
+    Blob **table = calloc(new_buckets, sizeof(Blob *));
+    if(!table){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    for(size_t i = 0; i < blob_buckets; i++){
+        Blob *b = blob_table[i];
+        while(b){
+            Blob *next = b->next;
+            b->next = table[b->hash & (new_buckets - 1)];
+            table[b->hash & (new_buckets - 1)] = b;
+            b = next;
         }
     }
-    printf("No history found for the file: %s\n", name);   
+    free(blob_table);
+    blob_table = table;
+    blob_buckets = new_buckets;
 }
 
-// frees up the memory
-void cleanup(){
-    for(int i = 0; i < file_count; i++){
-        for(int j = 0; j < files[i].log_count; j++){
-            free(files[i].log_history[j].content);
-            free(files[i].log_history[j].author_name);
-            free(files[i].log_history[j].comment);
-        }
-        free(files[i].name);
+// appends an unsigned LEB128 varint, returns the bytes written
+static size_t put_varint(unsigned char *p, uint64_t v){
+    size_t n = 0;
+    while(v >= 0x80){
+        p[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
     }
-    free(files);
-    for(int i = 0; i < snapshot_count; i++){
-        for(int j = 0; j < snapshots[i].file_count; j++){
-            for(int k = 0; k < snapshots[i].files[j].log_count; k++){
-                free(snapshots[i].files[j].log_history[k].content);
-                free(snapshots[i].files[j].log_history[k].author_name);
-                free(snapshots[i].files[j].log_history[k].comment);
-            }
-            free(snapshots[i].files[j].name);
-        }
-        free(snapshots[i].files);
-        free(snapshots[i].tag);
+    p[n++] = (unsigned char)v;
+    return n;
+}
+
+// reads an unsigned LEB128 varint ending before end and advances the cursor; a varint that runs into end, or
+// past 64 bits, leaves the cursor at end and reads as UINT64_MAX
+static uint64_t get_varint(const unsigned char **p, const unsigned char *end){
+    uint64_t v = 0;
+    for(int shift = 0; *p < end && shift < 64; shift += 7){
+        unsigned char byte = *(*p)++;
+        v |= (uint64_t)(byte & 0x7f) << shift;
+        if(!(byte & 0x80)) return v;
     }
-    free(snapshots);
+    *p = end;
+    return UINT64_MAX;
 }
 
-// help for interactive command-line execution
-void help(){
-    printf("***** Available commands *****\n");
-    printf("add <file_name> <file_path> <author> <note>     ---> Add a new file\n");
-    printf("viewfs                                          ---> View all files\n");
-    printf("view <file_name>                                ---> View latest file content\n");
-    printf("delete <file_name>                              ---> Delete a file\n");
-    printf("recover <file_name> <user>                      ---> Recover a deleted file\n");
-    printf("log <file_name>                                 ---> View log history\n");
-    printf("snapshot <tag>                                  ---> Create snapshot\n");
-    printf("rollback <index>                                ---> Rollback to snapshot\n");
-    printf("deletesnap <tag>                                ---> Delete snapshot\n");
-    printf("obsoletesnap <tag>                              ---> Obsolete snapshot\n");
-    printf("recoversnap <index>                             ---> Recover snapshot\n");
-    printf("listsnap                                        ---> List snapshots\n");
-    printf("revert <file_name> <version>                    ---> Revert file to version\n");
-    printf("save <filename>                                 ---> Save state to disk\n");
-    printf("load <filename>                                 ---> Load state from disk\n");
-    printf("help                                            ---> Show this help\n");
-    printf("exit                                            ---> Exit the program\n");
-}
-
-int main(){
-    char cmd[512];
-    printf("------------------------------------ Version Based File System ------------------------------------ \n");
-    printf("\nWelcome!...\n");
-    printf("Starting the CLI...\n\n");
-    help();
-    while(1){
-        printf("\n> ");
-        if(!fgets(cmd, sizeof(cmd), stdin)) break;
-        char *args[6];
-        int argc = 0;
-        char *token = strtok(cmd, " \n");
-        while (token && argc < 6) {
-            args[argc++] = token;
-            token = strtok(NULL, " \n");
-        }
-        if(argc == 0) continue;
-        if(strcmp(args[0], "add") == 0 && argc == 5){
-            add_file(args[1], args[2], args[3], args[4]);
-        }
-        else if(strcmp(args[0], "viewfs") == 0){
-            view_fileSystem();
-        }
-        else if(strcmp(args[0], "view") == 0 && argc == 2){
-            view_fileContent(args[1]);
-        }
-        else if(strcmp(args[0], "delete") == 0 && argc == 2){
-            delete_file(args[1]);
-        }
-        else if(strcmp(args[0], "recover") == 0 && argc == 2){
-            recover_file(args[1]);
-        }
-        else if(strcmp(args[0], "log") == 0 && argc == 2){
-            log_history(args[1]);
-        }
-        else if(strcmp(args[0], "snapshot") == 0 && argc == 2){
-            create_snapshot(args[1]);
-        }
-        else if(strcmp(args[0], "rollback") == 0 && argc == 2){
-            rollback(atoi(args[1]));
-        }
-        else if(strcmp(args[0], "deletesnap") == 0 && argc == 2){
-            delete_snapshot(args[1]);
-        }
-        else if(strcmp(args[0], "obsoletesnap") == 0 && argc == 2){
-            obsolete_snapshot(args[1]);
-        }
-        else if(strcmp(args[0], "recoversnap") == 0 && argc == 2){
-            recover_snapshot(atoi(args[1]));
+// hash of the DELTA_BLOCK bytes starting at p
+static inline uint64_t hash_block(const char *p){
+    uint64_t a, b;
+    memcpy(&a, p, 8);
+    memcpy(&b, p + 8, 8);
+    uint64_t h = (a * 0x9e3779b97f4a7c15ULL) ^ (b * 0xc4ceb9fe1a85ec53ULL);
+    return h ^ (h >> 31);
+}
+
+// encodes target as copy/insert operations against base
+// ops are varints: (len << 1 | 1) followed by the base offset for a copy,
+// (len << 1) followed by the literal bytes for an insert
+// returns NULL when the delta would not be smaller than half the target
+static char* delta_encode(const char *base, size_t base_len, const char *target, size_t len, size_t *out_len){
+    if(base_len < DELTA_BLOCK || len < DELTA_BLOCK || base_len > DELTA_MAX_LEN) return NULL;
+    size_t limit = len / 2;
+    size_t blocks = base_len / DELTA_BLOCK;
+    size_t cap = 1;
+    while(cap < blocks * 2) cap <<= 1;
+    size_t *index = malloc(cap * sizeof(size_t));
+    unsigned char *out = malloc(limit + 1);
+    if(!index || !out){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(index, 0xff, cap * sizeof(size_t));
+    for(size_t i = 0; i < blocks; i++){
+        index[hash_block(base + i * DELTA_BLOCK) & (cap - 1)] = i * DELTA_BLOCK;
+    }
+
+    size_t o = 0, pos = 0, lit = 0;
+    while(pos + DELTA_BLOCK <= len){
+        size_t cand = index[hash_block(target + pos) & (cap - 1)];
+        if(cand == SIZE_MAX || memcmp(base + cand, target + pos, DELTA_BLOCK) != 0){
+            pos++;
+            continue;
         }
-        else if(strcmp(args[0], "listsnap") == 0){
-            list_snapshots();
+        size_t start = pos, src = cand;
+        while(start > lit && src > 0 && base[src - 1] == target[start - 1]){
+            start--;
+            src--;
         }
-        else if(strcmp(args[0], "revert") == 0 && argc == 3){
-            revert_file(args[1], atoi(args[2]));
+        size_t end = pos + DELTA_BLOCK, src_end = cand + DELTA_BLOCK;
+        while(end < len && src_end < base_len && base[src_end] == target[end]){
+            end++;
+            src_end++;
         }
-        else if(strcmp(args[0], "save") == 0 && argc == 2){
-            save_to_disk(args[1]);
+        if(o + (start - lit) + 30 > limit) break;
+        if(start > lit){
+            o += put_varint(out + o, (uint64_t)(start - lit) << 1);
+            memcpy(out + o, target + lit, start - lit);
+            o += start - lit;
         }
-        else if(strcmp(args[0], "load") == 0 && argc == 2){
-            load_from_disk(args[1]);
+        o += put_varint(out + o, (uint64_t)(end - start) << 1 | 1);
+        o += put_varint(out + o, src);
+        pos = lit = end;
+    }
+    free(index);
+    if(o + (len - lit) + 10 > limit){
+        free(out);
+        return NULL;
+    }
+    if(len > lit){
+        o += put_varint(out + o, (uint64_t)(len - lit) << 1);
+        memcpy(out + o, target + lit, len - lit);
+        o += len - lit;
+    }
+    *out_len = o;
+    return (char *)out;
+}
+
+// rebuilds the target of a delta into out, which holds out_len bytes; returns -1 when an operation reaches
+// outside the base, the delta or out, or the target does not fill out exactly
+static int delta_apply(const char *base, size_t base_len, const char *delta, size_t delta_len, char *out,
+                       size_t out_len){
+    const unsigned char *p = (const unsigned char *)delta;
+    const unsigned char *end = p + delta_len;
+    char *limit = out + out_len;
+    while(p < end){
+        uint64_t op = get_varint(&p, end);
+        uint64_t n = op >> 1;
+        if(n > (uint64_t)(limit - out)) return -1;
+        if(op & 1){
+            uint64_t from = get_varint(&p, end);
+            if(from > base_len || n > base_len - from) return -1;
+            memcpy(out, base + from, n);
         }
-        else if(strcmp(args[0], "help") == 0){
-            help();
+        else{
+            if(n > (uint64_t)(end - p)) return -1;
+            memcpy(out, p, n);
+            p += n;
         }
-        else if(strcmp(args[0], "exit") == 0){
-            cleanup();
-            printf("Cleaning up...\n");
-            printf("Exiting...\n");
+        out += n;
+    }
+    return out == limit ? 0 : -1;
+}
+
+// largest output of the LZ codecs for len input bytes
+static size_t lz_bound(size_t len){
+    return len + len / 255 + 16;
+}
+
+// hash of the LZ_MIN_MATCH bytes at p, reduced to bits bits
+static inline uint32_t lz_hash(const char *p, int bits){
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return (v * 2654435761u) >> (32 - bits);
+}
+
+// length of the common run of a and b, at most limit bytes
+static inline size_t lz_common(const char *a, const char *b, size_t limit){
+    size_t n = 0;
+    while(n + 8 <= limit){
+        uint64_t x, y;
+        memcpy(&x, a + n, 8);
+        memcpy(&y, b + n, 8);
+        if(x != y) return n + (__builtin_ctzll(x ^ y) >> 3);
+        n += 8;
+    }
+    while(n < limit && a[n] == b[n]) n++;
+    return n;
+}
+
+// writes a length that did not fit its 4-bit token field as 255-valued bytes and a remainder
+static char* lz_put_length(char *o, size_t n){
+    while(n >= 255){
+        *o++ = (char)255;
+        n -= 255;
+    }
+    *o++ = (char)n;
+    return o;
+}
+
+// writes one sequence: the literals from lit to pos, then a match of match_len bytes offset back
+// (LZ4 block layout: token with 4-bit literal and match lengths, literals, 2-byte offset, length extensions)
+static char* lz_put_sequence(char *o, const char *lit, const char *pos, size_t offset, size_t match_len){
+    size_t lits = pos - lit, ml = match_len - LZ_MIN_MATCH;
+    char *token = o++;
+    *token = (char)((lits < 15 ? lits : 15) << 4 | (ml < 15 ? ml : 15));
+    if(lits >= 15) o = lz_put_length(o, lits - 15);
+    memcpy(o, lit, lits);
+    o += lits;
+    *o++ = (char)(offset & 0xff);
+    *o++ = (char)(offset >> 8);
+    if(ml >= 15) o = lz_put_length(o, ml - 15);
+    return o;
+}
+
+// writes the final literals, which have no match after them
+static char* lz_put_tail(char *o, const char *lit, const char *end){
+    size_t lits = end - lit;
+    *o++ = (char)((lits < 15 ? lits : 15) << 4);
+    if(lits >= 15) o = lz_put_length(o, lits - 15);
+    memcpy(o, lit, lits);
+    return o + lits;
+}
+
+// packs as is
+static size_t store_pack(const char *src, size_t len, char *dst){
+    memcpy(dst, src, len);
+    return len;
+}
+
+// unpacks data packed as is
+static int store_unpack(const char *src, size_t len, char *dst, size_t raw){
+    if(len != raw) return -1;
+    memcpy(dst, src, len);
+    return 0;
+}
+
+// greedy LZ: one hash table slot per position, the step grows over incompressible stretches
+static size_t lz_fast_pack(const char *src, size_t len, char *dst){
+    uint32_t table[1 << LZ_FAST_BITS];
+    memset(table, 0xff, sizeof(table));
+    const char *lit = src, *end = src + len;
+    char *o = dst;
+    size_t pos = 0, misses = 0;
+    // the last bytes are always literals so a match never reads past the end
+    size_t limit = len > LZ_MIN_MATCH + 8 ? len - LZ_MIN_MATCH - 8 : 0;
+    while(pos < limit){
+        uint32_t h = lz_hash(src + pos, LZ_FAST_BITS);
+        uint32_t cand = table[h];
+        table[h] = pos;
+        if(cand == UINT32_MAX || pos - cand > LZ_WINDOW || memcmp(src + cand, src + pos, LZ_MIN_MATCH) != 0){
+            pos += 1 + (misses++ >> 6);
+            continue;
+        }
+        misses = 0;
+        size_t start = pos, from = cand;
+        while(start > (size_t)(lit - src) && from > 0 && src[start - 1] == src[from - 1]){
+            start--;
+            from--;
+        }
+        size_t n = pos - start + LZ_MIN_MATCH + lz_common(src + pos + LZ_MIN_MATCH, src + cand + LZ_MIN_MATCH, limit - pos);
+        o = lz_put_sequence(o, lit, src + start, start - from, n);
+        pos = start + n;
+        lit = src + pos;
+        if(pos - 2 < limit) table[lz_hash(src + pos - 2, LZ_FAST_BITS)] = pos - 2;
+    }
+    return lz_put_tail(o, lit, end) - dst;
+}
+
+// longest match for position pos among the chain of earlier positions with the same hash
+static size_t lz_high_match(const char *src, size_t pos, size_t limit, const LzChains *lz, int max_depth, size_t *match_at){
+    size_t best = 0;
+    uint32_t cand = lz->head[lz_hash(src + pos, lz->bits)];
+    for(int depth = 0; depth < max_depth && cand != UINT32_MAX && pos - cand <= LZ_WINDOW; depth++){
+        if(src[cand + best] == src[pos + best]){
+            size_t n = lz_common(src + cand, src + pos, limit + LZ_MIN_MATCH - pos);
+            if(n > best){
+                best = n;
+                *match_at = cand;
+                if(best >= LZ_HIGH_NICE) break;
+            }
+        }
+        uint32_t next = lz->chain[cand & lz->mask];
+        if(next >= cand) break;
+        cand = next;
+    }
+    return best >= LZ_MIN_MATCH ? best : 0;
+}
+
+// inserts position pos into the hash chains
+static inline void lz_high_insert(const char *src, size_t pos, LzChains *lz){
+    uint32_t h = lz_hash(src + pos, lz->bits);
+    lz->chain[pos & lz->mask] = lz->head[h];
+    lz->head[h] = pos;
+}
+
+// LZ with hash chains: tries LZ_HIGH_DEPTH earlier positions and defers a match by one byte
+// when the next position has a longer one
+static size_t lz_high_pack(const char *src, size_t len, char *dst){
+    LzChains lz;
+    lz.bits = 8;
+    while(lz.bits < LZ_HIGH_BITS && ((size_t)1 << lz.bits) < len) lz.bits++;
+    size_t chain_len = 256;
+    while(chain_len <= LZ_WINDOW && chain_len < len) chain_len *= 2;
+    lz.mask = chain_len - 1;
+    lz.head = malloc(sizeof(uint32_t) << lz.bits);
+    lz.chain = malloc(sizeof(uint32_t) * chain_len);
+    if(!lz.head || !lz.chain){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(lz.head, 0xff, sizeof(uint32_t) << lz.bits);
+    const char *lit = src, *end = src + len;
+    char *o = dst;
+    size_t pos = 0;
+    size_t limit = len > LZ_MIN_MATCH + 8 ? len - LZ_MIN_MATCH - 8 : 0;
+    while(pos < limit){
+        size_t at = 0;
+        size_t n = lz_high_match(src, pos, limit, &lz, LZ_HIGH_DEPTH, &at);
+        lz_high_insert(src, pos, &lz);
+        if(n && n < LZ_HIGH_NICE && pos + 1 < limit){
+            size_t next_at = 0;
+            // the look-ahead only decides whether to defer, so a shallower search is enough
+            if(lz_high_match(src, pos + 1, limit, &lz, LZ_HIGH_DEPTH / 4, &next_at) > n){
+                pos++;
+                continue;
+            }
+        }
+        if(!n){
+            pos++;
+            continue;
+        }
+        o = lz_put_sequence(o, lit, src + pos, pos - at, n);
+        for(size_t k = pos + 1; k < pos + n && k < limit; k++) lz_high_insert(src, k, &lz);
+        pos += n;
+        lit = src + pos;
+    }
+    free(lz.head);
+    free(lz.chain);
+    return lz_put_tail(o, lit, end) - dst;
+}
+
+// reads a length extension of the LZ format
+static int lz_get_length(const unsigned char **p, const unsigned char *end, size_t *n){
+    unsigned char c;
+    do{
+        if(*p >= end) return -1;
+        c = *(*p)++;
+        *n += c;
+    }while(c == 255);
+    return 0;
+}
+
+// unpacks the sequences written by both LZ codecs
+static int lz_unpack(const char *src, size_t len, char *dst, size_t raw){
+    const unsigned char *p = (const unsigned char *)src, *end = p + len;
+    char *o = dst, *o_end = dst + raw;
+    while(p < end){
+        unsigned token = *p++;
+        size_t lits = token >> 4;
+        if(lits == 15 && lz_get_length(&p, end, &lits) < 0) return -1;
+        if(lits > (size_t)(end - p) || lits > (size_t)(o_end - o)) return -1;
+        // short runs dominate on text: copy a fixed 16 bytes when both buffers have room
+        if(lits <= 16 && end - p >= 16 && o_end - o >= 16) memcpy(o, p, 16);
+        else memcpy(o, p, lits);
+        o += lits;
+        p += lits;
+        if(p == end) break;
+        if(end - p < 2) return -1;
+        size_t offset = p[0] | (size_t)p[1] << 8;
+        p += 2;
+        size_t n = token & 15;
+        if(n == 15 && lz_get_length(&p, end, &n) < 0) return -1;
+        n += LZ_MIN_MATCH;
+        if(offset == 0 || offset > (size_t)(o - dst) || n > (size_t)(o_end - o)) return -1;
+        const char *from = o - offset;
+        if(offset >= 8 && (size_t)(o_end - o) >= n + 8){
+            // 8-byte steps stay correct for overlapping copies once the offset is at least 8
+            char *stop = o + n;
+            for(char *w = o; w < stop; w += 8, from += 8) memcpy(w, from, 8);
+            o = stop;
+        }
+        else if(offset >= n){
+            memcpy(o, from, n);
+            o += n;
+        }
+        else{
+            for(size_t k = 0; k < n; k++) *o++ = from[k];
+        }
+    }
+    return o == o_end ? 0 : -1;
+}
+
+static const Codec codecs[CODEC_COUNT] = {
+    {"none", store_pack, store_unpack},
+    {"fast", lz_fast_pack, lz_unpack},
+    {"high", lz_high_pack, lz_unpack}
+};
+
+// log2 of n in 16.16 fixed point, the fraction interpolated linearly (off by less than 0.09)
+static uint64_t fixed_log2(uint64_t n){
+    int msb = 63 - __builtin_clzll(n);
+    return (uint64_t)msb << 16 | (((n << 16) >> msb) & 0xffff);
+}
+
+// order-0 entropy of the bytes, in bits per byte times 65536
+static uint64_t byte_entropy(const unsigned char *p, size_t len){
+    size_t count[256] = {0};
+    for(size_t i = 0; i < len; i++) count[p[i]]++;
+    uint64_t bits = 0;
+    for(int c = 0; c < 256; c++){
+        if(count[c]) bits += count[c] * (fixed_log2(len) - fixed_log2(count[c]));
+    }
+    return bits / len;
+}
+
+// codec data of this size is packed with: tiny or high-entropy data is kept as is,
+// under 'set codec auto' small blobs get the fast codec and larger ones the high-ratio codec
+static int choose_codec(const char *data, size_t len){
+    if(len < CODEC_MIN || codec_choice == CODEC_NONE) return CODEC_NONE;
+    if(byte_entropy((const unsigned char *)data, len < CODEC_SAMPLE ? len : CODEC_SAMPLE) > CODEC_MAX_ENTROPY) return CODEC_NONE;
+    if(codec_choice != CODEC_AUTO) return codec_choice;
+    return len < CODEC_HIGH_MIN ? CODEC_FAST : CODEC_HIGH;
+}
+
+// makes data (malloc'd, len bytes) the content of the blob, packed when that saves an eighth or more
+static void blob_pack(Blob *b, char *data, size_t len){
+    int codec = choose_codec(data, len);
+    b->raw = len;
+    if(codec != CODEC_NONE){
+        char *packed = malloc(lz_bound(len) + 1);
+        if(!packed){
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+        size_t n = codecs[codec].pack(data, len, packed);
+        if(n <= len - len / 8){
+            free(data);
+            b->data = realloc(packed, n + 1);
+            if(!b->data){
+                fprintf(stderr, "Error: Memory allocation failed\n");
+                exit(EXIT_FAILURE);
+            }
+            b->data[n] = '\0';
+            b->stored = n;
+            b->codec = codec;
+            return;
+        }
+        free(packed);
+    }
+    b->data = realloc(data, len + 1);
+    if(!b->data){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    b->data[len] = '\0';
+    b->stored = len;
+    b->codec = CODEC_NONE;
+}
+
+// unpacks the blob's data into dst, which holds b->raw bytes
+static void blob_unpack(const Blob *b, char *dst){
+    if(codecs[b->codec].unpack(b->data, b->stored, dst, b->raw) < 0){
+        fprintf(stderr, "Error: Stored content is corrupt\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// random 64-bit values per byte for the gear rolling hash, fixed so chunk boundaries are stable across runs
+static const uint64_t* gear_table(){
+    static uint64_t gear[256];
+    static int ready = 0;
+    if(!ready){
+        uint64_t x = 0x2545f4914f6cdd1dULL;
+        for(int i = 0; i < 256; i++){
+            uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            gear[i] = z ^ (z >> 31);
+        }
+        ready = 1;
+    }
+    return gear;
+}
+
+// length of the content-defined chunk starting at p (FastCDC with normalised chunking)
+// the gear hash only depends on the last 64 bytes, and the boundary test looks at its high bits;
+// the loop is a table lookup, shift and add per byte with no other data-dependent branches
+static size_t cdc_next(const unsigned char *p, size_t len, const uint64_t *gear){
+    if(len <= CHUNK_MIN) return len;
+    size_t end = len < CHUNK_MAX ? len : CHUNK_MAX;
+    size_t normal = len < CHUNK_AVG ? len : CHUNK_AVG;
+    uint64_t h = 0;
+    size_t i = CHUNK_MIN;
+    for(; i < normal; i++){
+        h = (h << 1) + gear[p[i]];
+        if(!(h & CHUNK_MASK_SMALL)) return i + 1;
+    }
+    for(; i < end; i++){
+        h = (h << 1) + gear[p[i]];
+        if(!(h & CHUNK_MASK_LARGE)) return i + 1;
+    }
+    return end;
+}
+
+// unlinks a cache entry from the use order; cache_lock is held
+static void cache_unlink(CacheEntry *e){
+    if(e->prev) e->prev->next = e->next;
+    else cache_head = e->next;
+    if(e->next) e->next->prev = e->prev;
+    else cache_tail = e->prev;
+}
+
+// makes a cache entry the most recently used one; cache_lock is held
+static void cache_push(CacheEntry *e){
+    e->prev = NULL;
+    e->next = cache_head;
+    if(cache_head) cache_head->prev = e;
+    else cache_tail = e;
+    cache_head = e;
+}
+
+// frees a cache entry no reader holds; cache_lock is held
+static void cache_remove(CacheEntry *e){
+    cache_unlink(e);
+    e->blob->cached = NULL;
+    cache_bytes -= e->blob->len + 1 + sizeof(CacheEntry);
+    cache_count--;
+    free(e->content);
+    free(e);
+}
+
+// evicts the least recently used entries no reader holds until the cache fits its budget; cache_lock is held
+static void cache_trim(){
+    for(CacheEntry *e = cache_tail; e && cache_bytes > cache_budget; ){
+        CacheEntry *prev = e->prev;
+        if(!e->pins) cache_remove(e);
+        e = prev;
+    }
+}
+
+// the cached full content of a blob, held until blob_put, or NULL
+static const char* cache_get(Blob *b){
+    pthread_mutex_lock(&cache_lock);
+    CacheEntry *e = b->cached;
+    if(e){
+        e->pins++;
+        cache_unlink(e);
+        cache_push(e);
+        cache_hits++;
+    }
+    else cache_misses++;
+    pthread_mutex_unlock(&cache_lock);
+    return e ? e->content : NULL;
+}
+
+// keeps the full content just built for a blob (a malloc'd buffer) and returns the content to read, held until
+// blob_put; content larger than a quarter of the budget is not kept, so one read cannot empty the cache
+static const char* cache_put(Blob *b, char *content){
+    size_t size = b->len + 1 + sizeof(CacheEntry);
+    if(size > cache_budget / 4) return content;
+    CacheEntry *e = malloc(sizeof(CacheEntry));
+    if(!e){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_lock(&cache_lock);
+    if(b->cached){
+        // another reader built the same content meanwhile
+        const char *kept = b->cached->content;
+        b->cached->pins++;
+        pthread_mutex_unlock(&cache_lock);
+        free(content);
+        free(e);
+        return kept;
+    }
+    e->blob = b;
+    e->content = content;
+    e->pins = 1;
+    b->cached = e;
+    cache_push(e);
+    cache_bytes += size;
+    cache_count++;
+    cache_trim();
+    pthread_mutex_unlock(&cache_lock);
+    return content;
+}
+
+// lets go of a content blob_get returned; 0 when it did not come from the cache
+static int cache_release(Blob *b, const char *content){
+    pthread_mutex_lock(&cache_lock);
+    CacheEntry *e = b->cached;
+    int held = e && e->content == content;
+    if(held && --e->pins == 0 && cache_bytes > cache_budget) cache_trim();
+    pthread_mutex_unlock(&cache_lock);
+    return held;
+}
+
+// releases content returned by blob_get
+static void blob_put(Blob *b, const char *content){
+    if((b->base || b->chunks || b->codec != CODEC_NONE) && !cache_release(b, content)) free((char *)content);
+}
+
+static const char* blob_build(Blob *b, int keep);
+
+// returns the full content of a blob, unpacking it, applying its delta chain or joining its chunks if needed;
+// pair with blob_put
+static const char* blob_get(Blob *b){
+    return blob_build(b, 1);
+}
+
+// blob_get, keeping what it builds in the content cache only when keep is set; the links of a delta chain
+// and the chunks of a file are read through the cache but not added to it, so one deep read cannot fill it
+static const char* blob_build(Blob *b, int keep){
+    if(!b->base && !b->chunks && b->codec == CODEC_NONE) return b->data;
+    const char *cached = cache_get(b);
+    if(cached) return cached;
+    char *out = malloc(b->len + 1);
+    if(!out){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    if(b->chunks){
+        size_t pos = 0;
+        for(int k = 0; k < b->chunk_count; k++){
+            Blob *chunk = b->chunks[k];
+            if(!chunk->base && !chunk->chunks){
+                blob_unpack(chunk, out + pos);
+            }
+            else{
+                const char *content = blob_build(chunk, 0);
+                memcpy(out + pos, content, chunk->len);
+                blob_put(chunk, content);
+            }
+            pos += chunk->len;
+        }
+    }
+    else if(b->base){
+        const char *base = blob_build(b->base, 0);
+        char *delta = b->data;
+        if(b->codec != CODEC_NONE){
+            delta = malloc(b->raw + 1);
+            if(!delta){
+                fprintf(stderr, "Error: Memory allocation failed\n");
+                exit(EXIT_FAILURE);
+            }
+            blob_unpack(b, delta);
+        }
+        if(delta_apply(base, b->base->len, delta, b->raw, out, b->len) != 0){
+            fprintf(stderr, "Error: Stored content is corrupt\n");
+            exit(EXIT_FAILURE);
+        }
+        if(delta != b->data) free(delta);
+        blob_put(b->base, base);
+    }
+    else{
+        blob_unpack(b, out);
+    }
+    out[b->len] = '\0';
+    return keep ? cache_put(b, out) : out;
+}
+
+// takes another reference to a blob
+static Blob* blob_retain(Blob *b){
+    __atomic_add_fetch(&b->refs, 1, __ATOMIC_RELAXED);
+    return b;
+}
+
+// finds a stored blob with exactly this content
+static Blob* blob_find(uint64_t hash, const char *data, size_t len){
+    if(!blob_buckets) return NULL;
+    for(Blob *b = blob_table[hash & (blob_buckets - 1)]; b; b = b->next){
+        if(b->hash != hash || b->len != len) continue;
+        const char *content = blob_get(b);
+        int same = memcmp(content, data, len) == 0;
+        blob_put(b, content);
+        if(same) return b;
+    }
+    return NULL;
+}
+
+// links a new blob into the store
+static void blob_link(Blob *b){
+    if(blob_count >= blob_buckets) blob_table_grow();
+    b->next = blob_table[b->hash & (blob_buckets - 1)];
+    blob_table[b->hash & (blob_buckets - 1)] = b;
+    blob_count++;
+    if(!b->chunks) blob_bytes += b->len;
+    blob_stored += b->stored;
+}
+
+// a new blob of len bytes of content with this hash, holding no data yet and with one reference
+static Blob* blob_alloc(uint64_t hash, size_t len){
+    Blob *b = malloc(sizeof(Blob));
+    if(!b){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    b->hash = hash;
+    b->len = len;
+    b->refs = 1;
+    b->depth = 0;
+    b->base = NULL;
+    b->chunks = NULL;
+    b->chunk_count = 0;
+    b->save_id = -1;
+    b->cached = NULL;
+    b->codec = CODEC_NONE;
+    b->raw = 0;
+    return b;
+}
+
+// a blob for content (taking ownership of the malloc'd buffer) that is not linked into the store: packed,
+// or a delta against prev when its chain is shorter than keyframe_interval. It only reads prev, so import
+// workers build blobs in parallel; content of CHUNK_FILE_MIN or more is left to blob_adopt_delta
+static Blob* blob_new(char *data, size_t len, uint64_t hash, Blob *prev){
+    Blob *b = blob_alloc(hash, len);
+    if(prev && prev->depth + 1 < keyframe_interval){
+        const char *base = blob_get(prev);
+        size_t delta_len;
+        char *delta = delta_encode(base, prev->len, data, len, &delta_len);
+        blob_put(prev, base);
+        if(delta){
+            free(data);
+            blob_pack(b, delta, delta_len);
+            b->base = blob_retain(prev);
+            b->depth = prev->depth + 1;
+        }
+    }
+    if(!b->base) blob_pack(b, data, len);
+    return b;
+}
+
+// stores the content (taking ownership of the malloc'd buffer) and returns a new reference to its blob
+// when prev is given and its chain is shorter than keyframe_interval, the content is kept as a delta against it
+static Blob* blob_adopt_delta(char *data, size_t len, Blob *prev){
+    uint64_t hash = hash_bytes(data, len);
+    Blob *b = blob_find(hash, data, len);
+    if(b){
+        free(data);
+        b->refs++;
+        return b;
+    }
+    if(len >= CHUNK_FILE_MIN){
+        b = blob_alloc(hash, len);
+        const uint64_t *gear = gear_table();
+        int cap = len / CHUNK_AVG + 1;
+        b->chunks = malloc(cap * sizeof(Blob *));
+        for(size_t pos = 0; pos < len; ){
+            size_t n = cdc_next((const unsigned char *)data + pos, len - pos, gear);
+            char *chunk = malloc(n + 1);
+            if(b->chunk_count == cap){
+                cap *= 2;
+                b->chunks = realloc(b->chunks, cap * sizeof(Blob *));
+            }
+            if(!chunk || !b->chunks){
+                fprintf(stderr, "Error: Memory allocation failed\n");
+                exit(EXIT_FAILURE);
+            }
+            memcpy(chunk, data + pos, n);
+            b->chunks[b->chunk_count++] = blob_adopt_delta(chunk, n, NULL);
+            pos += n;
+        }
+        free(data);
+        b->data = NULL;
+        b->stored = 0;
+        blob_link(b);
+        return b;
+    }
+    b = blob_new(data, len, hash, prev);
+    blob_link(b);
+    return b;
+}
+
+// removes an unused blob (and whatever it alone kept alive) from the store
+static void blob_free(Blob *b){
+    while(b){
+        Blob *base = b->base;
+        Blob **link = &blob_table[b->hash & (blob_buckets - 1)];
+        while(*link != b) link = &(*link)->next;
+        *link = b->next;
+        blob_count--;
+        if(!b->chunks) blob_bytes -= b->len;
+        blob_stored -= b->stored;
+        if(b->cached){
+            pthread_mutex_lock(&cache_lock);
+            cache_remove(b->cached);
+            pthread_mutex_unlock(&cache_lock);
+        }
+        for(int k = 0; k < b->chunk_count; k++){
+            if(--b->chunks[k]->refs == 0) blob_free(b->chunks[k]);
+        }
+        free(b->chunks);
+        if(!is_mapped(b->data)) free(b->data);
+        free(b);
+        b = base && --base->refs == 0 ? base : NULL;
+    }
+}
+
+// drops a reference to a blob, removing it from the store once unused
+// in a pool job the blob is only collected, the store belongs to the main thread
+static void blob_release(Blob *b){
+    if(b && __atomic_sub_fetch(&b->refs, 1, __ATOMIC_ACQ_REL) == 0){
+        if(dead_blobs) buffer_append(dead_blobs, &b, sizeof(b));
+        else blob_free(b);
+    }
+}
+
+// frees a blob blob_new built that was never linked into the store
+static void blob_discard(Blob *b){
+    if(b->base) blob_release(b->base);
+    free(b->data);
+    free(b);
+}
+
+// copies len bytes of the cold tier at ref into dst
+static int cold_fetch(uint64_t ref, void *dst, size_t len){
+    if(ref < cold_mapped_len){
+        if(len > cold_mapped_len - ref) return -1;
+        memcpy(dst, cold_mapped + ref, len);
+        return 0;
+    }
+    ref -= cold_mapped_len;
+    if(cold_fd < 0 || ref > cold_spilled || len > cold_spilled - ref) return -1;
+    for(size_t done = 0; done < len; ){
+        ssize_t n = pread(cold_fd, (char *)dst + done, len - done, ref + done);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return -1;
+        io_count(IO_READ, n);
+        done += n;
+    }
+    return 0;
+}
+
+// bytes the cold tier record at ref takes, 0 when it cannot be read
+static uint64_t cold_record_size(uint64_t ref){
+    ColdRecord rec;
+    if(cold_fetch(ref, &rec, sizeof(rec)) != 0) return 0;
+    return sizeof(rec) + (uint64_t)rec.comment_len + rec.author_len + 2 + rec.stored;
+}
+
+// reads a version back from the cold tier, its content only when with_content is set;
+// free the strings and content with cold_entry_free
+static int cold_read(uint64_t ref, ColdEntry *entry, int with_content){
+    ColdRecord *rec = &entry->rec;
+    entry->comment = entry->author_name = entry->content = NULL;
+    if(cold_fetch(ref, rec, sizeof(*rec)) != 0 || rec->codec < 0 || rec->codec >= CODEC_COUNT
+       || (rec->codec == CODEC_NONE && rec->stored != rec->len)) return -1;
+    size_t strings = (size_t)rec->comment_len + rec->author_len + 2;
+    entry->comment = malloc(strings);
+    if(with_content) entry->content = malloc(rec->len + 1);
+    char *packed = with_content && rec->codec != CODEC_NONE ? malloc(rec->stored + 1) : entry->content;
+    if(!entry->comment || (with_content && (!entry->content || !packed))){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    entry->author_name = entry->comment + rec->comment_len + 1;
+    int bad = cold_fetch(ref + sizeof(*rec), entry->comment, strings) != 0
+              || entry->comment[rec->comment_len] || entry->author_name[rec->author_len];
+    if(!bad && with_content){
+        bad = cold_fetch(ref + sizeof(*rec) + strings, packed, rec->stored) != 0
+              || (packed != entry->content && codecs[rec->codec].unpack(packed, rec->stored, entry->content, rec->len) < 0);
+        entry->content[rec->len] = '\0';
+    }
+    if(packed != entry->content) free(packed);
+    if(bad){
+        free(entry->comment);
+        free(entry->content);
+        return -1;
+    }
+    return 0;
+}
+
+// frees what cold_read allocated
+static void cold_entry_free(ColdEntry *entry){
+    free(entry->comment);
+    free(entry->content);
+}
+
+// appends a version to the spill file, packing its content with the current codec,
+// and returns its cold tier reference, or UINT64_MAX when it could not be written
+static uint64_t cold_write(const LogEntry *log){
+    if(cold_fd < 0){
+        char path[] = "/tmp/vfs_cold_XXXXXX";
+        cold_fd = mkstemp(path);
+        if(cold_fd < 0) return UINT64_MAX;
+        unlink(path);
+        io_count(IO_OPEN, 0);
+    }
+    Blob *b = log->content;
+    const char *content = blob_get(b);
+    ColdRecord rec = {b->len, b->len, log->timestamp, log->version_id, choose_codec(content, b->len),
+                      strlen(log->comment), strlen(log->author_name)};
+    char *packed = NULL;
+    if(rec.codec != CODEC_NONE){
+        packed = malloc(lz_bound(b->len));
+        if(!packed){
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+        rec.stored = codecs[rec.codec].pack(content, b->len, packed);
+        if(rec.stored > b->len - b->len / 8){
+            rec.codec = CODEC_NONE;
+            rec.stored = b->len;
+        }
+    }
+    struct iovec parts[4] = {
+        {&rec, sizeof(rec)}, {log->comment, rec.comment_len + 1}, {log->author_name, rec.author_len + 1},
+        {rec.codec != CODEC_NONE ? packed : (char *)content, rec.stored}
+    };
+    size_t size = sizeof(rec) + rec.comment_len + rec.author_len + 2 + rec.stored;
+    ssize_t n = pwritev(cold_fd, parts, 4, cold_spilled);
+    blob_put(b, content);
+    free(packed);
+    if(n < 0 || (size_t)n != size) return UINT64_MAX;
+    io_count(IO_WRITE, n);
+    uint64_t ref = cold_mapped_len + cold_spilled;
+    cold_spilled += size;
+    return ref;
+}
+
+// copies a string into the arena unless it is a view into the mapped state file
+static char* arena_keep(Arena *arena, char *str){
+    return is_mapped(str) ? str : arena_strdup(arena, str);
+}
+
+// copies a log entry into the arena, sharing its content blob
+static void copy_log(LogEntry *dst, const LogEntry *src, Arena *arena){
+    dst->content = blob_retain(src->content);
+    dst->comment = arena_keep(arena, src->comment);
+    dst->author_name = arena_keep(arena, src->author_name);
+    dst->timestamp = src->timestamp;
+    dst->version_id = src->version_id;
+}
+
+// drops the content of a log entry, its strings go with the arena that owns them
+static void release_log(LogEntry *log){
+    blob_release(log->content);
+}
+
+// drops a log entry of a page's file, counting its strings as garbage of the page's arena
+static void forget_log(FilePage *page, LogEntry *log){
+    if(!is_mapped(log->comment)) page->garbage += strlen(log->comment) + 1;
+    if(!is_mapped(log->author_name)) page->garbage += strlen(log->author_name) + 1;
+    release_log(log);
+}
+
+// the current version of a file
+static LogEntry* file_latest(const File *file){
+    return &file->log_history[file->hot_count - 1];
+}
+
+// sets up the in-memory versions of a file for count entries, inline when there is one
+static void hot_init(File *file, int count){
+    file->hot_count = 0;
+    file->hot_cap = count > 1 ? count : 1;
+    file->log_history = &file->first_log;
+    if(count > 1){
+        file->log_history = malloc(count * sizeof(LogEntry));
+        if(!file->log_history){
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// a new slot after a file's in-memory versions, counted as its newest version
+static LogEntry* hot_push(File *file){
+    if(file->hot_count == file->hot_cap){
+        LogEntry *grown = malloc(file->hot_cap * 2 * sizeof(LogEntry));
+        if(!grown){
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(grown, file->log_history, file->hot_count * sizeof(LogEntry));
+        if(file->log_history != &file->first_log) free(file->log_history);
+        file->log_history = grown;
+        file->hot_cap *= 2;
+    }
+    file->log_count++;
+    return &file->log_history[file->hot_count++];
+}
+
+// makes a file's cold references a heap array with room for one more, copying them out of the state file
+static void cold_reserve(File *file){
+    if(!is_mapped(file->cold) && file->cold_count < file->cold_cap) return;
+    int cap = file->cold_count < 2 ? 4 : file->cold_count * 2;
+    ColdRef *grown = malloc(cap * sizeof(ColdRef));
+    if(!grown){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    if(file->cold_count) memcpy(grown, file->cold, file->cold_count * sizeof(ColdRef));
+    if(!is_mapped(file->cold)) free(file->cold);
+    file->cold = grown;
+    file->cold_cap = cap;
+}
+
+// the entries a heap event list of count events has allocated: the next power of two, so it needs no field
+static int event_cap(int count){
+    int cap = 1;
+    while(cap < count) cap <<= 1;
+    return cap;
+}
+
+// makes room for one more event of a live file, copying a list that is still in the mapped state file
+static void event_reserve(File *file){
+    int n = file->event_count;
+    if(n && !is_mapped(file->events) && n < event_cap(n)) return;
+    FileEvent *grown = malloc(event_cap(n + 1) * sizeof(FileEvent));
+    if(!grown){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    if(n) memcpy(grown, file->events, n * sizeof(FileEvent));
+    if(!is_mapped(file->events)) free(file->events);
+    file->events = grown;
+}
+
+// records a change of a live file; the clock may step back, but events stay in time order
+static void event_push(File *file, time_t at, int kind, uint64_t hash){
+    event_reserve(file);
+    if(file->event_count && at < file->events[file->event_count - 1].at) at = file->events[file->event_count - 1].at;
+    file->events[file->event_count++] = (FileEvent){at, hash, kind, 0};
+}
+
+// whether a file records which content was current when, which it does from its first revert on
+static int file_timed(const File *file){
+    for(int e = file->event_count - 1; e >= 0; e--){
+        if(file->events[e].kind == EVENT_CONTENT) return 1;
+    }
+    return 0;
+}
+
+// the newest version of a file holding content with this hash, 0 when none does
+static int version_holding(const File *file, uint64_t hash){
+    for(int j = file->hot_count - 1; j >= 0; j--){
+        if(file->log_history[j].content->hash == hash) return file->cold_count + j + 1;
+    }
+    for(int j = file->cold_count - 1; j >= 0; j--){
+        if(file->cold[j].hash == hash) return j + 1;
+    }
+    return 0;
+}
+
+// drops the events of a live file from before the first content it still holds, once its oldest versions
+// are gone, so a reverted file under retention does not collect them
+static void event_prune(File *file){
+    int first = 0;
+    while(first < file->event_count && (file->events[first].kind != EVENT_CONTENT
+                                        || !version_holding(file, file->events[first].hash))) first++;
+    if(first == 0 || first == file->event_count) return;
+    event_reserve(file);
+    file->event_count -= first;
+    memmove(file->events, file->events + first, file->event_count * sizeof(FileEvent));
+}
+
+// moves the oldest in-memory versions of a live file to the cold tier until hot_versions are left;
+// a version that cannot be written stays in memory
+static void spill_versions(FilePage *page, File *file){
+    int spilled = 0;
+    while(file->hot_count - spilled > hot_versions){
+        uint64_t ref = cold_write(&file->log_history[spilled]);
+        if(ref == UINT64_MAX) break;
+        cold_reserve(file);
+        file->cold[file->cold_count++] = (ColdRef){ref, file->log_history[spilled].content->hash};
+        forget_log(page, &file->log_history[spilled++]);
+    }
+    if(!spilled) return;
+    file->hot_count -= spilled;
+    memmove(file->log_history, file->log_history + spilled, file->hot_count * sizeof(LogEntry));
+}
+
+// copies a file with its whole log history into the arena, cold references still in the mapped state
+// file stay views into it
+static void copy_file(File *dst, const File *src, Arena *arena){
+    dst->log_count = src->log_count;
+    hot_init(dst, src->hot_count);
+    dst->hot_count = src->hot_count;
+    for(int j = 0; j < src->hot_count; j++){
+        copy_log(&dst->log_history[j], &src->log_history[j], arena);
+    }
+    dst->cold_count = dst->cold_cap = src->cold_count;
+    dst->cold = src->cold_count ? src->cold : NULL;
+    if(src->cold_count && !is_mapped(src->cold)){
+        dst->cold = malloc(src->cold_count * sizeof(ColdRef));
+        if(!dst->cold){
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(dst->cold, src->cold, src->cold_count * sizeof(ColdRef));
+    }
+    dst->event_count = src->event_count;
+    dst->events = src->event_count ? src->events : NULL;
+    if(src->event_count && !is_mapped(src->events)){
+        dst->events = malloc(event_cap(src->event_count) * sizeof(FileEvent));
+        if(!dst->events){
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(dst->events, src->events, src->event_count * sizeof(FileEvent));
+    }
+}
+
+// drops the content of a file's whole log history
+static void release_file(File *file){
+    for(int j = 0; j < file->hot_count; j++){
+        release_log(&file->log_history[j]);
+    }
+    if(file->log_history != &file->first_log) free(file->log_history);
+    if(!is_mapped(file->cold)) free(file->cold);
+    if(!is_mapped(file->events)) free(file->events);
+}
+
+// a page with every slot free, held once
+static FilePage* page_new(){
+    FilePage *page = calloc(1, sizeof(FilePage));
+    if(!page){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    page->refs = 1;
+    page->save_id = -1;
+    return page;
+}
+
+// a private copy of a shared page, sharing the content blobs of its files
+static FilePage* page_copy(const FilePage *src){
+    FilePage *page = page_new();
+    page->used = src->used;
+    page->deleted = src->deleted;
+    memcpy(page->latest, src->latest, sizeof(page->latest));
+    for(uint64_t used = src->used; used; used &= used - 1){
+        int k = __builtin_ctzll(used);
+        copy_file(&page->files[k], &src->files[k], &page->arena);
+    }
+    return page;
+}
+
+// refreshes the hot region's copy of a file's current content after its history changed
+static void page_sync(FilePage *page, int k){
+    const File *file = &page->files[k];
+    page->latest[k] = file->hot_count ? file_latest(file)->content : NULL;
+}
+
+// drops a reference to a page, releasing its files with the last one
+static void page_release(FilePage *page){
+    if(!page || --page->refs > 0) return;
+    for(uint64_t used = page->used; used; used &= used - 1){
+        release_file(&page->files[__builtin_ctzll(used)]);
+    }
+    arena_release(&page->arena);
+    free(page);
+}
+
+// moves the strings of a page's files into a fresh arena once most of the old one is garbage
+static void compact_page(FilePage *page){
+    if(page->garbage < ARENA_BLOCK || page->garbage * 2 < page->arena.bytes) return;
+    Arena fresh = {NULL, 0};
+    for(uint64_t used = page->used; used; used &= used - 1){
+        File *file = &page->files[__builtin_ctzll(used)];
+        for(int j = 0; j < file->hot_count; j++){
+            LogEntry *log = &file->log_history[j];
+            log->comment = arena_keep(&fresh, log->comment);
+            log->author_name = arena_keep(&fresh, log->author_name);
+        }
+    }
+    arena_release(&page->arena);
+    page->arena = fresh;
+    page->garbage = 0;
+}
+
+// an empty table of page_count pages, held once
+static FileTable* table_new(int page_count){
+    FileTable *table = malloc(sizeof(FileTable));
+    FilePage **pages = calloc(page_count ? page_count : 1, sizeof(FilePage *));
+    if(!table || !pages){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    table->refs = 1;
+    table->page_count = page_count;
+    table->pages = pages;
+    return table;
+}
+
+// takes another reference to a table
+static FileTable* table_retain(FileTable *table){
+    if(table) table->refs++;
+    return table;
+}
+
+// pool job releasing pages begin..end-1 of a table
+static void release_pages(void *ctx, int begin, int end){
+    FileTable *table = ctx;
+    Buffer dead = {NULL, 0, 0};
+    dead_blobs = &dead;
+    for(int p = begin; p < end; p++){
+        page_release(table->pages[p]);
+    }
+    dead_blobs = NULL;
+    if(dead.len){
+        pthread_mutex_lock(&pool_lock);
+        buffer_append(&pool_dead, dead.data, dead.len);
+        pthread_mutex_unlock(&pool_lock);
+    }
+    free(dead.data);
+}
+
+// drops a reference to a table, releasing the pages only it held with the last one
+// the pages are released by the worker pool, the blobs they leave unused are removed from the store after
+static void table_release(FileTable *table){
+    if(!table || --table->refs > 0) return;
+    parallel_for(table->page_count, release_pages, table);
+    for(size_t i = 0; i < pool_dead.len / sizeof(Blob *); i++){
+        blob_free(((Blob **)pool_dead.data)[i]);
+    }
+    pool_dead.len = 0;
+    free(table->pages);
+    free(table);
+}
+
+// number of file ids a table has slots for
+static int table_slots(const FileTable *table){
+    return table ? table->page_count * PAGE_FILES : 0;
+}
+
+// the page holding the slot of a file id in a table, or NULL when the table does not hold it
+static FilePage* table_page(const FileTable *table, int id){
+    if(!table || id < 0 || id >= table_slots(table)) return NULL;
+    FilePage *page = table->pages[id / PAGE_FILES];
+    return page && page->used >> (id % PAGE_FILES) & 1 ? page : NULL;
+}
+
+// the file with this id in a table, or NULL when the table does not hold it
+static File* table_file(const FileTable *table, int id){
+    FilePage *page = table_page(table, id);
+    return page ? &page->files[id % PAGE_FILES] : NULL;
+}
+
+// whether a table holds the file with this id as deleted
+static int table_deleted(const FileTable *table, int id){
+    FilePage *page = table_page(table, id);
+    return page && page->deleted >> (id % PAGE_FILES) & 1;
+}
+
+// whether a table holds the file with this id and it is not deleted
+static int table_present(const FileTable *table, int id){
+    return table_page(table, id) && !table_deleted(table, id);
+}
+
+// the page a live file id lives in, ready to be changed
+// a live table or page that a snapshot still shares is copied first, so only the path to the change is copied
+static FilePage* live_page(int id){
+    int p = id / PAGE_FILES;
+    if(!live){
+        live = table_new(0);
+    }
+    else if(live->refs > 1){
+        FileTable *copy = table_new(live->page_count);
+        for(int q = 0; q < live->page_count; q++){
+            copy->pages[q] = live->pages[q];
+            if(copy->pages[q]) copy->pages[q]->refs++;
+        }
+        live->refs--;
+        live = copy;
+    }
+    if(p >= live->page_count){
+        live->pages = realloc(live->pages, (p + 1) * sizeof(FilePage *));
+        if(!live->pages){
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+        memset(live->pages + live->page_count, 0, (p + 1 - live->page_count) * sizeof(FilePage *));
+        live->page_count = p + 1;
+    }
+    FilePage *page = live->pages[p];
+    if(!page){
+        page = live->pages[p] = page_new();
+    }
+    else if(page->refs > 1){
+        page->refs--;
+        page = live->pages[p] = page_copy(page);
+    }
+    return page;
+}
+
+// drops a snapshot's table and tag
+static void release_snapshot(Snapshot *snapshot){
+    table_release(snapshot->table);
+    if(!is_mapped(snapshot->tag)) free(snapshot->tag);
+}
+
+// name of a file id
+static const char* file_key(int id){
+    return file_names[id];
+}
+
+// tag of the snapshot in a snapshots slot
+static const char* snapshot_key(int slot){
+    return snapshots[slot].tag;
+}
+
+// puts a slot into the first free position of its probe sequence
+static void index_place(NameIndex *index, uint64_t hash, int slot){
+    size_t pos = hash & (index->cap - 1);
+    while(index->slots[pos].slot >= 0) pos = (pos + 1) & (index->cap - 1);
+    index->slots[pos].hash = hash;
+    index->slots[pos].slot = slot;
+}
+
+// resizes the index so it stays at most half full for count entries
+static void index_reserve(NameIndex *index, size_t count){
+    if(count * 2 <= index->cap) return;
+    size_t cap = index->cap ? index->cap : 64;
+    while(count * 2 > cap) cap *= 2;
+    IndexSlot *old = index->slots;
+    size_t old_cap = index->cap;
+    index->slots = malloc(cap * sizeof(IndexSlot));
+    if(!index->slots){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(index->slots, 0xff, cap * sizeof(IndexSlot));
+    index->cap = cap;
+    for(size_t i = 0; i < old_cap; i++){
+        if(old[i].slot >= 0) index_place(index, old[i].hash, old[i].slot);
+    }
+    free(old);
+}
+
+// adds the entry in slot under the key it currently holds
+static void index_insert(NameIndex *index, const char *(*key_of)(int), int slot){
+    const char *key = key_of(slot);
+    index_reserve(index, index->used + 1);
+    index_place(index, hash_bytes(key, strlen(key)), slot);
+    index->used++;
+}
+
+// returns the slot holding key, or -1; when accept is given, slots it rejects are skipped
+static int index_find(const NameIndex *index, const char *key, const char *(*key_of)(int), int (*accept)(int)){
+    if(!index->cap) return -1;
+    uint64_t hash = hash_bytes(key, strlen(key));
+    size_t pos = hash & (index->cap - 1);
+    while(index->slots[pos].slot >= 0){
+        int slot = index->slots[pos].slot;
+        if(index->slots[pos].hash == hash && strcmp(key_of(slot), key) == 0 && (!accept || accept(slot))){
+            return slot;
+        }
+        pos = (pos + 1) & (index->cap - 1);
+    }
+    return -1;
+}
+
+// rebuilds the index over slots 0..count-1 after they were replaced or shifted
+static void index_rebuild(NameIndex *index, int count, const char *(*key_of)(int)){
+    if(index->cap) memset(index->slots, 0xff, index->cap * sizeof(IndexSlot));
+    index->used = 0;
+    for(int i = 0; i < count; i++){
+        index_insert(index, key_of, i);
+    }
+}
+
+// whether the live file system holds a file id
+static int is_live(int id){
+    return table_page(live, id) != NULL;
+}
+
+// id of the live file with this name, or -1
+static int find_file(const char *name){
+    return index_find(&file_index, name, file_key, is_live);
+}
+
+// hands out the next file id for a name
+// ids are never reused, so every table agrees on them, a rollback leaves the index as it is and ids stay in
+// the order files were added; a name added again after a rollback gets a new id next to its old one
+static int intern_file(const char *name){
+    if(name_count == name_cap){
+        name_cap = name_cap ? name_cap * 2 : 64;
+        file_names = realloc(file_names, name_cap * sizeof(char *));
+        if(!file_names){
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    file_names[name_count] = arena_keep(&name_arena, (char *)name);
+    index_insert(&file_index, file_key, name_count);
+    return name_count++;
+}
+
+// slot of the snapshot with this tag, or -1
+static int find_snapshot(const char *tag){
+    return index_find(&snapshot_names, tag, snapshot_key, NULL);
+}
+
+// orders page and table pointers for deduplication
+static int compare_pointer(const void *a, const void *b){
+    uintptr_t x = (uintptr_t)*(void *const *)a, y = (uintptr_t)*(void *const *)b;
+    return x < y ? -1 : x > y;
+}
+
+// table i of those kept besides the live tree: the snapshots', then the ones rollbacks replaced
+static FileTable* kept_table(int i){
+    return i < snapshot_count ? snapshots[i].table : rollbacks[i - snapshot_count].table;
+}
+
+// every distinct page of the live tree, the snapshots and the trees rollbacks replaced, in a malloc'd array
+static FilePage** state_pages(size_t *count){
+    size_t total = live ? live->page_count : 0;
+    for(int i = 0; i < snapshot_count + rollback_count; i++){
+        if(kept_table(i)) total += kept_table(i)->page_count;
+    }
+    FilePage **pages = malloc((total + 1) * sizeof(FilePage *));
+    if(!pages){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    *count = 0;
+    for(int i = -1; i < snapshot_count + rollback_count; i++){
+        const FileTable *table = i < 0 ? live : kept_table(i);
+        for(int p = 0; table && p < table->page_count; p++){
+            if(table->pages[p]) pages[(*count)++] = table->pages[p];
+        }
+    }
+    qsort(pages, *count, sizeof(FilePage *), compare_pointer);
+    size_t kept = 0;
+    for(size_t i = 0; i < *count; i++){
+        if(i == 0 || pages[i] != pages[i - 1]) pages[kept++] = pages[i];
+    }
+    *count = kept;
+    return pages;
+}
+
+// document indexed for a content hash, or -1
+static int search_find(uint64_t hash){
+    if(!search_index.cap) return -1;
+    for(size_t pos = hash & (search_index.cap - 1); search_index.slots[pos].slot >= 0; pos = (pos + 1) & (search_index.cap - 1)){
+        if(search_index.slots[pos].hash == hash) return search_index.slots[pos].slot;
+    }
+    return -1;
+}
+
+// position of a trigram's posting list in a probe table, or of the free position it would take
+static size_t posting_slot(const Posting *table, size_t cap, uint32_t trigram){
+    size_t pos = (size_t)(((uint64_t)trigram * 0x9e3779b97f4a7c15ULL) >> 32) & (cap - 1);
+    while(table[pos].runs && table[pos].trigram != trigram) pos = (pos + 1) & (cap - 1);
+    return pos;
+}
+
+// places a posting list in the probe table, which has a free position for it
+static Posting* posting_place(Posting *table, size_t cap, uint32_t trigram){
+    Posting *p = &table[posting_slot(table, cap, trigram)];
+    p->trigram = trigram;
+    return p;
+}
+
+// rebuilds the probe table with room for count lists, leaving out the lists that became empty
+static void posting_resize(size_t count){
+    size_t cap = 1024;
+    while(count * 2 > cap) cap *= 2;
+    Posting *table = calloc(cap, sizeof(Posting));
+    if(!table){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    search_used = 0;
+    for(size_t i = 0; i < search_cap; i++){
+        if(!search_postings[i].runs) continue;
+        if(!search_postings[i].count){
+            free(search_postings[i].runs);
+            continue;
+        }
+        *posting_place(table, cap, search_postings[i].trigram) = search_postings[i];
+        search_used++;
+    }
+    free(search_postings);
+    search_postings = table;
+    search_cap = cap;
+}
+
+// posting list of a trigram, NULL when no document has it
+static const Posting* posting_find(uint32_t trigram){
+    if(!search_cap) return NULL;
+    const Posting *p = &search_postings[posting_slot(search_postings, search_cap, trigram)];
+    return p->runs ? p : NULL;
+}
+
+// the distinct trigrams of a text, in a malloc'd array; the seen bitmap is left clear, so only one thread
+// may index at a time
+static uint32_t* text_trigrams(const char *text, size_t len, size_t *count){
+    if(!search_seen){
+        search_seen = calloc((1 << 24) / 64, sizeof(uint64_t));
+        if(!search_seen){
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    const unsigned char *p = (const unsigned char *)text;
+    size_t n = len < 3 ? 0 : len - 2;
+    uint32_t *found = malloc((n < (1 << 24) ? n : (1 << 24)) * sizeof(uint32_t) + sizeof(uint32_t));
+    if(!found){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    *count = 0;
+    uint32_t t = n ? (uint32_t)p[0] << 8 | p[1] : 0;
+    for(size_t i = 0; i < n; i++){
+        t = (t << 8 | p[i + 2]) & 0xffffff;
+        uint64_t bit = 1ULL << (t & 63);
+        if(search_seen[t >> 6] & bit) continue;
+        search_seen[t >> 6] |= bit;
+        found[(*count)++] = t;
+    }
+    for(size_t i = 0; i < *count; i++){
+        search_seen[found[i] >> 6] = 0;
+    }
+    return found;
+}
+
+// adds a document to the end of a posting list, extending its last run when the document follows it
+static void posting_append(Posting *p, uint32_t doc){
+    if(p->count && p->runs[p->count - 1].first + p->runs[p->count - 1].count == doc){
+        p->runs[p->count - 1].count++;
+        return;
+    }
+    if(p->count == p->cap){
+        p->cap = p->cap ? p->cap * 2 : 2;
+        DocRun *grown = realloc(p->runs, p->cap * sizeof(DocRun));
+        if(!grown){
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+        p->runs = grown;
+    }
+    p->runs[p->count++] = (DocRun){doc, 1};
+}
+
+// whether a content is left out of the index: binary data holding NULs, or high-entropy data like the codec
+// leaves unpacked, would add a posting list for most of the 2^24 trigrams and narrow no search; grep reads it
+// on every search instead
+static int search_skips(const char *text, size_t len){
+    size_t sample = len < CODEC_SAMPLE ? len : CODEC_SAMPLE;
+    if(sample < CODEC_MIN) return 0;
+    return memchr(text, '\0', sample) || byte_entropy((const unsigned char *)text, sample) > CODEC_MAX_ENTROPY;
+}
+
+// indexes a content under its hash unless it already is or is left out
+static void search_add(uint64_t hash, const char *text, size_t len){
+    if(search_find(hash) >= 0 || search_skips(text, len)) return;
+    if(search_doc_count == search_doc_cap){
+        search_doc_cap = search_doc_cap ? search_doc_cap * 2 : 1024;
+        uint64_t *grown = realloc(search_docs, search_doc_cap * sizeof(uint64_t));
+        if(!grown){
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+        search_docs = grown;
+    }
+    uint32_t doc = search_doc_count++;
+    search_docs[doc] = hash;
+    index_reserve(&search_index, search_index.used + 1);
+    index_place(&search_index, hash, doc);
+    search_index.used++;
+    size_t count;
+    uint32_t *trigrams = text_trigrams(text, len, &count);
+    if((search_used + count) * 2 > search_cap) posting_resize(search_used + count);
+    for(size_t i = 0; i < count; i++){
+        Posting *p = posting_place(search_postings, search_cap, trigrams[i]);
+        if(!p->runs) search_used++;
+        posting_append(p, doc);
+    }
+    free(trigrams);
+}
+
+// indexes every content the live tree and the snapshots hold, reading cold versions back once
+// a cold version that cannot be read is left out like a skipped content, grep then reads it on every search
+static void search_build(){
+    size_t count;
+    FilePage **pages = state_pages(&count);
+    for(size_t i = 0; i < count; i++){
+        for(uint64_t used = pages[i]->used; used; used &= used - 1){
+            const File *file = &pages[i]->files[__builtin_ctzll(used)];
+            for(int j = 0; j < file->hot_count; j++){
+                Blob *b = file->log_history[j].content;
+                if(search_find(b->hash) >= 0) continue;
+                const char *content = blob_get(b);
+                search_add(b->hash, content, b->len);
+                blob_put(b, content);
+            }
+            for(int j = 0; j < file->cold_count; j++){
+                ColdEntry entry;
+                if(search_find(file->cold[j].hash) >= 0 || cold_read(file->cold[j].ref, &entry, 1) != 0) continue;
+                search_add(file->cold[j].hash, entry.content, entry.rec.len);
+                cold_entry_free(&entry);
+            }
+        }
+    }
+    free(pages);
+    __atomic_store_n(&search_ready, 1, __ATOMIC_RELEASE);
+}
+
+// drops the documents no version of the live tree or a snapshot holds any more, renumbering the rest
+// in order so posting lists stay sorted
+static void search_prune(){
+    if(!search_ready || !search_doc_count) return;
+    uint32_t *renumber = calloc(search_doc_count, sizeof(uint32_t));
+    if(!renumber){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t count;
+    FilePage **pages = state_pages(&count);
+    for(size_t i = 0; i < count; i++){
+        for(uint64_t used = pages[i]->used; used; used &= used - 1){
+            const File *file = &pages[i]->files[__builtin_ctzll(used)];
+            for(int j = 0; j < file->hot_count + file->cold_count; j++){
+                int doc = search_find(j < file->hot_count ? file->log_history[j].content->hash : file->cold[j - file->hot_count].hash);
+                if(doc >= 0) renumber[doc] = 1;
+            }
+        }
+    }
+    free(pages);
+    uint32_t kept = 0;
+    for(uint32_t d = 0; d < search_doc_count; d++){
+        if(!renumber[d]){
+            renumber[d] = UINT32_MAX;
+            continue;
+        }
+        search_docs[kept] = search_docs[d];
+        renumber[d] = kept++;
+    }
+    if(kept < search_doc_count){
+        search_doc_count = kept;
+        memset(search_index.slots, 0xff, search_index.cap * sizeof(IndexSlot));
+        for(uint32_t d = 0; d < kept; d++){
+            index_place(&search_index, search_docs[d], d);
+        }
+        search_index.used = kept;
+        for(size_t i = 0; i < search_cap; i++){
+            Posting *p = &search_postings[i];
+            if(!p->runs) continue;
+            Posting pruned = {p->runs, 0, p->cap, p->trigram};
+            for(uint32_t k = 0; k < p->count; k++){
+                DocRun run = p->runs[k];
+                for(uint32_t d = run.first; d < run.first + run.count; d++){
+                    if(renumber[d] != UINT32_MAX) posting_append(&pruned, renumber[d]);
+                }
+            }
+            *p = pruned;
+        }
+        posting_resize(search_used);
+    }
+    free(renumber);
+}
+
+// drops the whole index, the next grep builds it again
+static void search_free(){
+    __atomic_store_n(&search_ready, 0, __ATOMIC_RELEASE);
+    for(size_t i = 0; i < search_cap; i++){
+        free(search_postings[i].runs);
+    }
+    free(search_postings);
+    search_postings = NULL;
+    search_cap = search_used = 0;
+    free(search_docs);
+    search_docs = NULL;
+    search_doc_count = search_doc_cap = 0;
+    free(search_index.slots);
+    search_index = (NameIndex){NULL, 0, 0};
+}
+
+// runs of the documents holding every trigram of a pattern, in a malloc'd array; count is -1 when the
+// pattern is too short to narrow the search and every version has to be read
+// readers share the index, so a trigram the pattern repeats is simply intersected again
+static DocRun* search_candidates(const char *pattern, size_t len, long *count){
+    const unsigned char *p = (const unsigned char *)pattern;
+    size_t n = len < 3 ? 0 : len - 2;
+    const Posting **lists = malloc((n + 1) * sizeof(Posting *));
+    if(!lists){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    *count = len < 3 ? -1 : 0;
+    size_t shortest = 0;
+    for(size_t i = 0; i < n; i++){
+        lists[i] = posting_find((uint32_t)p[i] << 16 | p[i + 1] << 8 | p[i + 2]);
+        if(!lists[i]){
+            n = 0;
+            break;
+        }
+        if(lists[i]->count < lists[shortest]->count) shortest = i;
+    }
+    DocRun *runs = NULL;
+    if(n){
+        runs = malloc(lists[shortest]->count * sizeof(DocRun));
+        if(!runs){
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(runs, lists[shortest]->runs, lists[shortest]->count * sizeof(DocRun));
+        *count = lists[shortest]->count;
+        for(size_t i = 0; i < n && *count; i++){
+            if(i == shortest) continue;
+            // every run of an intersection ends where a run of one of the two lists ends
+            const DocRun *other = lists[i]->runs;
+            DocRun *merged = malloc((*count + lists[i]->count) * sizeof(DocRun));
+            if(!merged){
+                fprintf(stderr, "Error: Memory allocation failed\n");
+                exit(EXIT_FAILURE);
+            }
+            long kept = 0;
+            for(uint32_t a = 0, b = 0; a < *count && b < lists[i]->count; ){
+                uint32_t end_a = runs[a].first + runs[a].count, end_b = other[b].first + other[b].count;
+                uint32_t from = runs[a].first > other[b].first ? runs[a].first : other[b].first;
+                uint32_t to = end_a < end_b ? end_a : end_b;
+                if(from < to) merged[kept++] = (DocRun){from, to - from};
+                if(end_a <= end_b) a++;
+                else b++;
+            }
+            free(runs);
+            runs = merged;
+            *count = kept;
+        }
+    }
+    free(lists);
+    return runs;
+}
+
+// whether a text holds a pattern; with SSE2, 16 positions at a time are tested against the pattern's
+// first and last byte and only the positions matching both are compared in full
+static int text_contains(const char *text, size_t len, const char *pattern, size_t n){
+    if(n > len) return 0;
+    if(n == 0) return 1;
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i first = _mm_set1_epi8(pattern[0]), last = _mm_set1_epi8(pattern[n - 1]);
+    for(; i + n - 1 + 16 <= len; i += 16){
+        __m128i a = _mm_cmpeq_epi8(first, _mm_loadu_si128((const __m128i *)(text + i)));
+        __m128i b = _mm_cmpeq_epi8(last, _mm_loadu_si128((const __m128i *)(text + i + n - 1)));
+        for(unsigned mask = _mm_movemask_epi8(_mm_and_si128(a, b)); mask; mask &= mask - 1){
+            if(n <= 2 || memcmp(text + i + __builtin_ctz(mask) + 1, pattern + 1, n - 2) == 0) return 1;
+        }
+    }
+#endif
+    for(; i + n <= len; i++){
+        if(text[i] == pattern[0] && memcmp(text + i, pattern, n) == 0) return 1;
+    }
+    return 0;
+}
+
+// frees every file and snapshot of the current state
+static void free_state(){
+    search_free();
+    table_release(live);
+    live = NULL;
+    for(int i = 0; i < snapshot_count; i++){
+        release_snapshot(&snapshots[i]);
+    }
+    free(snapshots);
+    snapshots = NULL;
+    snapshot_count = 0;
+    for(int i = 0; i < rollback_count; i++){
+        table_release(rollbacks[i].table);
+    }
+    free(rollbacks);
+    rollbacks = NULL;
+    rollback_count = 0;
+    free(file_names);
+    file_names = NULL;
+    name_count = 0;
+    name_cap = 0;
+    arena_release(&name_arena);
+    index_rebuild(&file_index, 0, file_key);
+    index_rebuild(&snapshot_names, 0, snapshot_key);
+}
+
+// numbers blobs so every delta comes after its base and every chunk list after its chunks, collecting them in save order
+static void order_blob(Blob *b, Blob **order, int *next_id){
+    if(b->save_id >= 0) return;
+    if(b->base) order_blob(b->base, order, next_id);
+    for(int k = 0; k < b->chunk_count; k++){
+        order_blob(b->chunks[k], order, next_id);
+    }
+    b->save_id = *next_id;
+    order[(*next_id)++] = b;
+}
+
+// appends the records of a file, its log history and its events; cold references are appended as they are
+// and renumbered once the whole cold section is laid out
+static void pack_file(const File *file, int id, int is_deleted, Buffer *file_table, Buffer *log_table, Buffer *cold_refs,
+                      Buffer *events, Buffer *strings){
+    FileRecord rec;
+    rec.first_log = log_table->len / sizeof(LogRecord);
+    rec.first_cold = cold_refs->len / sizeof(ColdRef);
+    rec.first_event = events->len / sizeof(FileEvent);
+    rec.id = id;
+    rec.log_count = file->hot_count;
+    rec.cold_count = file->cold_count;
+    rec.is_deleted = is_deleted;
+    rec.event_count = file->event_count;
+    rec.reserved = 0;
+    buffer_append(file_table, &rec, sizeof(rec));
+    buffer_append(cold_refs, file->cold, file->cold_count * sizeof(ColdRef));
+    buffer_append(events, file->events, file->event_count * sizeof(FileEvent));
+    for(int j = 0; j < file->hot_count; j++){
+        const LogEntry *log = &file->log_history[j];
+        LogRecord lrec;
+        lrec.comment = buffer_append(strings, log->comment, strlen(log->comment) + 1);
+        lrec.author_name = buffer_append(strings, log->author_name, strlen(log->author_name) + 1);
+        lrec.timestamp = log->timestamp;
+        lrec.blob_id = log->content->save_id;
+        lrec.version_id = log->version_id;
+        buffer_append(log_table, &lrec, sizeof(lrec));
+    }
+}
+
+// clears the save ids of a table's pages
+static void unmark_table(FileTable *table){
+    for(int p = 0; table && p < table->page_count; p++){
+        if(table->pages[p]) table->pages[p]->save_id = -1;
+    }
+}
+
+// appends the page references of a table, packing each page the first time any table refers to it
+static void pack_table(const FileTable *table, int *pages, Buffer *page_refs, Buffer *page_table,
+                       Buffer *file_table, Buffer *log_table, Buffer *cold_refs, Buffer *events, Buffer *strings){
+    for(int p = 0; table && p < table->page_count; p++){
+        FilePage *page = table->pages[p];
+        int32_t ref = -1;
+        if(page && page->save_id < 0){
+            PageRecord rec;
+            rec.first_file = file_table->len / sizeof(FileRecord);
+            rec.file_count = 0;
+            rec.reserved = 0;
+            for(uint64_t used = page->used; used; used &= used - 1){
+                int k = __builtin_ctzll(used);
+                pack_file(&page->files[k], p * PAGE_FILES + k, page->deleted >> k & 1, file_table, log_table, cold_refs,
+                          events, strings);
+                rec.file_count++;
+            }
+            buffer_append(page_table, &rec, sizeof(rec));
+            page->save_id = (*pages)++;
+        }
+        if(page) ref = page->save_id;
+        buffer_append(page_refs, &ref, sizeof(ref));
+    }
+}
+
+// writes the used part of a buffer
+static void write_buffer(FILE *fp, const Buffer *buf){
+    if(buf->len) fwrite(buf->data, 1, buf->len, fp);
+}
+
+// rounds a file offset up to the record alignment
+static uint64_t align8(uint64_t off){
+    return (off + 7) & ~(uint64_t)7;
+}
+
+// orders cold tier references
+static int compare_u64(const void *a, const void *b){
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// lays out the cold section of a state file: keeps the distinct records the packed files refer to, in
+// cold tier order, and rewrites the references as offsets within the section; returns the number of
+// records kept (their old references in order), or -1 when one of them cannot be read
+static long pack_cold(Buffer *cold_refs, uint64_t *order, uint64_t *section_len){
+    ColdRef *refs = (ColdRef *)cold_refs->data;
+    size_t count = cold_refs->len / sizeof(ColdRef);
+    for(size_t i = 0; i < count; i++){
+        order[i] = refs[i].ref;
+    }
+    qsort(order, count, sizeof(uint64_t), compare_u64);
+    long kept = 0;
+    for(size_t i = 0; i < count; i++){
+        if(i == 0 || order[i] != order[i - 1]) order[kept++] = order[i];
+    }
+    uint64_t *offsets = malloc((kept + 1) * sizeof(uint64_t));
+    if(!offsets){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    *section_len = 0;
+    for(long i = 0; i < kept; i++){
+        uint64_t size = cold_record_size(order[i]);
+        if(!size){
+            free(offsets);
+            return -1;
+        }
+        offsets[i] = *section_len;
+        *section_len += size;
+    }
+    for(size_t i = 0; i < count; i++){
+        const uint64_t *at = bsearch(&refs[i].ref, order, kept, sizeof(uint64_t), compare_u64);
+        refs[i].ref = offsets[at - order];
+    }
+    free(offsets);
+    return kept;
+}
+
+// writes the complete file system state as a new base image
+// the tables are packed in memory and written sequentially to a temporary file that replaces the target,
+// so a state file that is currently mapped stays intact
+static int write_state(const char *filename, uint64_t generation){
+    char tmp_name[4096];
+    snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", filename);
+    FILE *fp = io_fopen(tmp_name, "wb");
+    if(!fp){
+        print_errno("Error opening file for writing");
+        return -1;
+    }
+    setvbuf(fp, NULL, _IOFBF, 1 << 20);
+
+    Blob **order = malloc((blob_count + 1) * sizeof(Blob *));
+    for(size_t i = 0; i < blob_buckets; i++){
+        for(Blob *b = blob_table[i]; b; b = b->next) b->save_id = -1;
+    }
+    int blobs = 0;
+    for(size_t i = 0; i < blob_buckets; i++){
+        for(Blob *b = blob_table[i]; b; b = b->next) order_blob(b, order, &blobs);
+    }
+
+    Buffer blob_records = {NULL, 0, 0}, name_table = {NULL, 0, 0}, page_table = {NULL, 0, 0};
+    Buffer page_refs = {NULL, 0, 0}, file_table = {NULL, 0, 0}, log_table = {NULL, 0, 0};
+    Buffer cold_refs = {NULL, 0, 0}, events = {NULL, 0, 0}, snapshot_table = {NULL, 0, 0}, strings = {NULL, 0, 0};
+    Buffer rollback_table = {NULL, 0, 0};
+    uint64_t data_len = 0;
+    int32_t *chunk_ids = NULL;
+    int chunk_cap = 0;
+    for(int i = 0; i < blobs; i++){
+        BlobRecord rec;
+        rec.hash = order[i]->hash;
+        rec.len = order[i]->len;
+        rec.stored = order[i]->chunks ? order[i]->chunk_count * sizeof(int32_t) : order[i]->stored;
+        rec.data = data_len;
+        rec.raw = order[i]->raw;
+        rec.base_id = order[i]->base ? order[i]->base->save_id : -1;
+        rec.chunk_count = order[i]->chunk_count;
+        rec.codec = order[i]->codec;
+        if(order[i]->chunks){
+            if(order[i]->chunk_count > chunk_cap){
+                chunk_cap = order[i]->chunk_count;
+                free(chunk_ids);
+                chunk_ids = malloc(chunk_cap * sizeof(int32_t));
+                if(!chunk_ids){
+                    fprintf(stderr, "Error: Memory allocation failed\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            for(int k = 0; k < order[i]->chunk_count; k++) chunk_ids[k] = order[i]->chunks[k]->save_id;
+            rec.crc = crc32c(chunk_ids, rec.stored);
+        }
+        else rec.crc = crc32c(order[i]->data, rec.stored);
+        buffer_append(&blob_records, &rec, sizeof(rec));
+        data_len += rec.stored + 1;
+    }
+    for(int i = 0; i < name_count; i++){
+        uint64_t name = buffer_append(&strings, file_names[i], strlen(file_names[i]) + 1);
+        buffer_append(&name_table, &name, sizeof(name));
+    }
+    unmark_table(live);
+    for(int i = 0; i < snapshot_count + rollback_count; i++){
+        unmark_table(kept_table(i));
+    }
+    int pages = 0;
+    pack_table(live, &pages, &page_refs, &page_table, &file_table, &log_table, &cold_refs, &events, &strings);
+    uint32_t live_pages = page_refs.len / sizeof(int32_t);
+    for(int i = 0; i < snapshot_count; i++){
+        SnapshotRecord rec;
+        rec.tag = buffer_append(&strings, snapshots[i].tag, strlen(snapshots[i].tag) + 1);
+        rec.first_page = page_refs.len / sizeof(int32_t);
+        rec.timestamp = snapshots[i].timestamp;
+        rec.page_count = snapshots[i].table ? snapshots[i].table->page_count : 0;
+        rec.is_obsolete = snapshots[i].is_obsolete;
+        buffer_append(&snapshot_table, &rec, sizeof(rec));
+        pack_table(snapshots[i].table, &pages, &page_refs, &page_table, &file_table, &log_table, &cold_refs, &events,
+                   &strings);
+    }
+    for(int i = 0; i < rollback_count; i++){
+        RollbackRecord rec = {rollbacks[i].at, page_refs.len / sizeof(int32_t), 0, 0};
+        rec.page_count = rollbacks[i].table ? rollbacks[i].table->page_count : 0;
+        buffer_append(&rollback_table, &rec, sizeof(rec));
+        pack_table(rollbacks[i].table, &pages, &page_refs, &page_table, &file_table, &log_table, &cold_refs, &events,
+                   &strings);
+    }
+    uint64_t *cold_order = malloc((cold_refs.len / sizeof(ColdRef) + 1) * sizeof(uint64_t)), cold_len = 0;
+    if(!cold_order){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    long cold_kept = pack_cold(&cold_refs, cold_order, &cold_len);
+
+    StateHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, STATE_MAGIC, 4);
+    header.name_count = name_count;
+    header.snapshot_count = snapshot_count;
+    header.blob_count = blobs;
+    header.generation = generation;
+    header.page_count = pages;
+    header.live_pages = live_pages;
+    header.page_refs = page_refs.len / sizeof(int32_t);
+    header.file_records = file_table.len / sizeof(FileRecord);
+    header.log_records = log_table.len / sizeof(LogRecord);
+    header.cold_refs = cold_refs.len / sizeof(ColdRef);
+    header.event_records = events.len / sizeof(FileEvent);
+    header.rollback_count = rollback_count;
+    header.blob_table = sizeof(StateHeader);
+    header.name_table = header.blob_table + blob_records.len;
+    header.page_table = header.name_table + name_table.len;
+    header.page_ref_table = header.page_table + page_table.len;
+    header.file_table = align8(header.page_ref_table + page_refs.len);
+    header.log_table = header.file_table + file_table.len;
+    header.cold_ref_table = header.log_table + log_table.len;
+    header.event_table = header.cold_ref_table + cold_refs.len;
+    header.rollback_table = header.event_table + events.len;
+    header.snapshot_table = header.rollback_table + rollback_table.len;
+    header.string_section = header.snapshot_table + snapshot_table.len;
+    header.data_section = align8(header.string_section + strings.len);
+    header.cold_section = align8(header.data_section + data_len);
+    header.cold_size = cold_len;
+    header.size = header.cold_section + cold_len;
+    header.retention = retention;
+    header.hot_versions = hot_versions;
+
+    // the tables are all packed by now, so their checksum goes out with the header; the cold section's is
+    // known once its records have been copied and the header is rewritten then
+    static const char zeros[8] = {0};
+    const Buffer *tables[] = {&blob_records, &name_table, &page_table, &page_refs, NULL, &file_table, &log_table,
+                              &cold_refs, &events, &rollback_table, &snapshot_table, &strings, NULL};
+    uint64_t padding[] = {header.file_table - header.page_ref_table - page_refs.len,
+                          header.data_section - header.string_section - strings.len};
+    uint32_t meta_crc = crc32c(&header, offsetof(StateHeader, meta_crc));
+    for(int t = 0, pad = 0; t < (int)(sizeof(tables) / sizeof(tables[0])); t++){
+        uint64_t len = tables[t] ? tables[t]->len : padding[pad++];
+        meta_crc = crc32c_combine(meta_crc, crc32c(tables[t] ? tables[t]->data : zeros, len), len);
+    }
+    header.meta_crc = meta_crc;
+    fwrite(&header, sizeof(header), 1, fp);
+    write_buffer(fp, &blob_records);
+    write_buffer(fp, &name_table);
+    write_buffer(fp, &page_table);
+    write_buffer(fp, &page_refs);
+    fwrite(zeros, 1, header.file_table - header.page_ref_table - page_refs.len, fp);
+    write_buffer(fp, &file_table);
+    write_buffer(fp, &log_table);
+    write_buffer(fp, &cold_refs);
+    write_buffer(fp, &events);
+    write_buffer(fp, &rollback_table);
+    write_buffer(fp, &snapshot_table);
+    write_buffer(fp, &strings);
+    fwrite(zeros, 1, header.data_section - header.string_section - strings.len, fp);
+    for(int i = 0; i < blobs; i++){
+        for(int k = 0; k < order[i]->chunk_count; k++){
+            int32_t id = order[i]->chunks[k]->save_id;
+            fwrite(&id, sizeof(id), 1, fp);
+        }
+        if(!order[i]->chunks) fwrite(order[i]->data, 1, order[i]->stored, fp);
+        fwrite(zeros, 1, 1, fp);
+    }
+    free(chunk_ids);
+    fwrite(zeros, 1, header.cold_section - header.data_section - data_len, fp);
+    char *record = NULL;
+    uint64_t record_cap = 0;
+    for(long i = 0; i < cold_kept; i++){
+        uint64_t size = cold_record_size(cold_order[i]);
+        if(size > record_cap){
+            free(record);
+            record = malloc(size);
+            record_cap = size;
+            if(!record){
+                fprintf(stderr, "Error: Memory allocation failed\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        if(!size || cold_fetch(cold_order[i], record, size) != 0){
+            cold_kept = -1;
+            break;
+        }
+        fwrite(record, 1, size, fp);
+        header.cold_crc = crc32c_combine(header.cold_crc, crc32c(record, size), size);
+    }
+    free(record);
+    int failed = fseek(fp, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, fp) != 1;
+    free(cold_order);
+    free(order);
+    free(blob_records.data);
+    free(name_table.data);
+    free(page_table.data);
+    free(page_refs.data);
+    free(file_table.data);
+    free(log_table.data);
+    free(cold_refs.data);
+    free(events.data);
+    free(rollback_table.data);
+    free(snapshot_table.data);
+    free(strings.data);
+
+    if(ferror(fp)) failed = 1;
+    if(fclose(fp) != 0) failed = 1;
+    if(cold_kept < 0){
+        fprintf(cmd_err, "Error: A version in the cold tier could not be read\n");
+        unlink(tmp_name);
+        return -1;
+    }
+    if(failed || io_rename(tmp_name, filename) != 0){
+        print_errno("Error writing state file");
+        unlink(tmp_name);
+        return -1;
+    }
+    return 0;
+}
+
+// path of the journal that belongs to a state file
+static void journal_name(char *buf, size_t size, const char *filename){
+    snprintf(buf, size, "%s.journal", filename);
+}
+
+// a fresh identifier tying a journal to the base image it was started for
+static uint64_t new_generation(){
+    static uint64_t counter = 0;
+    uint64_t g = (uint64_t)time(NULL) * 0x9e3779b97f4a7c15ULL;
+    g ^= (uint64_t)getpid() << 32;
+    g ^= ++counter * 0xc4ceb9fe1a85ec53ULL;
+    return g;
+}
+
+static long replay_journal(const char *filename, uint64_t generation);
+
+// starts an empty journal for a state file just written as a full image, or removes a stale one when
+// journal mode is off; changes still in the journal buffer are appended by the next save
+static void journal_start(const char *filename, uint64_t generation){
+    char jname[4096];
+    journal_name(jname, sizeof(jname), filename);
+    free(journal_base);
+    journal_base = NULL;
+    if(journal_mode){
+        FILE *fp = io_fopen(jname, "wb");
+        if(!fp || fwrite(JOURNAL_MAGIC, 1, 4, fp) != 4 || fwrite(&generation, sizeof(generation), 1, fp) != 1){
+            print_errno("Error creating journal");
+            if(fp) fclose(fp);
+            unlink(jname);
+        }
+        else if(fclose(fp) == 0){
+            struct stat st;
+            journal_base = strdup(filename);
+            journal_size = 4 + sizeof(generation);
+            journal_base_size = stat(filename, &st) == 0 ? (size_t)st.st_size : 0;
+        }
+    }
+    else{
+        unlink(jname);
+    }
+}
+
+// waits for the background save, or only checks on it when block is not set, and reports how it went
+// once it has finished; returns 1 when a background save is still running
+static int bgsave_reap(int block){
+    int status;
+    if(bgsave_pid < 0) return 0;
+    pid_t pid;
+    do pid = waitpid(bgsave_pid, &status, block ? 0 : WNOHANG);
+    while(pid < 0 && errno == EINTR);
+    if(pid == 0) return 1;
+    bgsave_pid = -1;
+    if(pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0){
+        // the image holds the changes journaled before the fork, the journal keeps the later ones
+        size_t kept = journal.len > bgsave_journal ? journal.len - bgsave_journal : 0;
+        memmove(journal.data, journal.data + journal.len - kept, kept);
+        journal.len = kept;
+        journal_start(bgsave_target, bgsave_generation);
+        fprintf(cmd_out, "Background save to %s finished\n", bgsave_target);
+    }
+    else{
+        fprintf(cmd_err, "Error: Background save to %s failed\n", bgsave_target);
+    }
+    free(bgsave_target);
+    bgsave_target = NULL;
+    return 0;
+}
+
+// save the file system state to disk
+// in journal mode, saving to the current base only appends the changes made since the last save to
+// <file>.journal; the journal is folded into a new base image once it outgrows half of the base
+int save_to_disk(const char *filename){
+    bgsave_reap(1);
+    char jname[4096];
+    journal_name(jname, sizeof(jname), filename);
+    if(journal_mode && journal_base && strcmp(journal_base, filename) == 0
+       && (journal_size + journal.len < JOURNAL_MIN_COMPACT || (journal_size + journal.len) * 2 < journal_base_size)){
+        FILE *fp = io_fopen(jname, "ab");
+        if(!fp){
+            print_errno("Error opening journal for writing");
+            return VFS_IO;
+        }
+        size_t appended = journal.len;
+        write_buffer(fp, &journal);
+        int failed = ferror(fp);
+        if(fclose(fp) != 0) failed = 1;
+        if(failed){
+            print_errno("Error writing journal");
+            return VFS_IO;
+        }
+        journal_size += appended;
+        journal.len = 0;
+        fprintf(cmd_out, "Data successfully saved to %s (%zu bytes appended to journal)\n", filename, appended);
+        return VFS_OK;
+    }
+
+    uint64_t generation = new_generation();
+    if(write_state(filename, generation) != 0) return VFS_IO;
+    journal.len = 0;
+    journal_start(filename, generation);
+    fprintf(cmd_out, "Data successfully saved to %s\n", filename);
+    return VFS_OK;
+}
+
+// save the file system state to disk in a forked child while commands keep running
+// the child writes the state as it was at the fork, copy-on-write keeps it apart from later changes; it is
+// always a full image, written and synced like a save, and is reported on the first command after it ends
+int bgsave(const char *filename){
+    bgsave_reap(1);
+    uint64_t generation = new_generation();
+    pid_t pid = fork();
+    if(pid < 0){
+        print_errno("Error starting background save");
+        return VFS_IO;
+    }
+    if(pid == 0){
+        // the stream of the command that forked belongs to the parent, report errors on stderr instead
+        cmd_out = cmd_err = stderr;
+        _exit(write_state(filename, generation) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    bgsave_pid = pid;
+    bgsave_target = strdup(filename);
+    bgsave_generation = generation;
+    bgsave_journal = journal.len;
+    fprintf(cmd_out, "Background save to %s started (pid %d)\n", filename, (int)pid);
+    return VFS_OK;
+}
+
+// builds a file whose strings and cold references are views into the mapped state file
+static void map_file(FilePage *page, const FileRecord *rec, const PageLoad *load){
+    int k = rec->id % PAGE_FILES;
+    File *file = &page->files[k];
+    page->used |= 1ULL << k;
+    if(rec->is_deleted) page->deleted |= 1ULL << k;
+    file->log_count = rec->log_count + rec->cold_count;
+    file->cold_count = file->cold_cap = rec->cold_count;
+    file->cold = rec->cold_count ? (ColdRef *)(load->cold_table + rec->first_cold) : NULL;
+    file->event_count = rec->event_count;
+    file->events = rec->event_count ? (FileEvent *)(load->event_table + rec->first_event) : NULL;
+    hot_init(file, rec->log_count);
+    file->hot_count = rec->log_count;
+    const char *strings = load->strings;
+    Blob **ids = load->ids;
+    for(int j = 0; j < rec->log_count; j++){
+        const LogRecord *lrec = &load->log_table[rec->first_log + j];
+        LogEntry *log = &file->log_history[j];
+        log->content = blob_retain(ids[lrec->blob_id]);
+        log->comment = (char *)strings + lrec->comment;
+        log->author_name = (char *)strings + lrec->author_name;
+        log->timestamp = lrec->timestamp;
+        log->version_id = lrec->version_id;
+    }
+}
+
+// pool job building pages begin..end-1 of a mapped state file
+static void load_pages(void *ctx, int begin, int end){
+    PageLoad *load = ctx;
+    for(int i = begin; i < end; i++){
+        FilePage *page = page_new();
+        for(int j = 0; j < load->page_table[i].file_count; j++){
+            const FileRecord *rec = &load->file_table[load->page_table[i].first_file + j];
+            map_file(page, rec, load);
+            page_sync(page, rec->id % PAGE_FILES);
+        }
+        load->pages[i] = page;
+    }
+}
+
+// builds a table from its page references in the state file, sharing the pages already built
+static FileTable* map_table(const int32_t *refs, int page_count, FilePage **pages){
+    FileTable *table = table_new(page_count);
+    for(int p = 0; p < page_count; p++){
+        table->pages[p] = refs[p] >= 0 ? pages[refs[p]] : NULL;
+        if(table->pages[p]) table->pages[p]->refs++;
+    }
+    return table;
+}
+
+// checks that a table of count records of the given size lies within the state file
+static int table_fits(const StateHeader *h, uint64_t off, uint64_t count, size_t size){
+    return off <= h->size && count <= (h->size - off) / size;
+}
+
+// maps a state file and checks its header: the format, and that every table and section lies within the file;
+// returns the mapping (*len bytes), or NULL once the problem is reported
+static char* map_state(const char *filename, size_t *len){
+    int fd = io_open(filename, O_RDONLY, 0);
+    if(fd == -1){
+        print_errno("Error opening file for reading");
+        return NULL;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(StateHeader)){
+        fprintf(cmd_err, "Error: %s is not a saved file system state\n", filename);
+        close(fd);
+        return NULL;
+    }
+    char *map = io_map(fd, st.st_size);
+    close(fd);
+    if(map == MAP_FAILED){
+        print_errno("Error mapping state file");
+        return NULL;
+    }
+    const StateHeader *h = (const StateHeader *)map;
+    if(memcmp(h->magic, STATE_MAGIC, 4) != 0 || h->size != (uint64_t)st.st_size
+       || !table_fits(h, h->blob_table, h->blob_count, sizeof(BlobRecord))
+       || !table_fits(h, h->name_table, h->name_count, sizeof(uint64_t))
+       || !table_fits(h, h->page_table, h->page_count, sizeof(PageRecord))
+       || !table_fits(h, h->page_ref_table, h->page_refs, sizeof(int32_t))
+       || !table_fits(h, h->file_table, h->file_records, sizeof(FileRecord))
+       || !table_fits(h, h->log_table, h->log_records, sizeof(LogRecord))
+       || !table_fits(h, h->cold_ref_table, h->cold_refs, sizeof(ColdRef))
+       || !table_fits(h, h->event_table, h->event_records, sizeof(FileEvent))
+       || !table_fits(h, h->rollback_table, h->rollback_count, sizeof(RollbackRecord))
+       || !table_fits(h, h->cold_section, h->cold_size, 1)
+       || !table_fits(h, h->snapshot_table, h->snapshot_count, sizeof(SnapshotRecord))
+       || h->string_section > h->size || h->data_section > h->size || h->data_section < sizeof(StateHeader)){
+        fprintf(cmd_err, "Error: %s is not a saved file system state\n", filename);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    *len = st.st_size;
+    return map;
+}
+
+// what a pool job checking a state file's checksums works on: the tables and the cold section are split
+// into CRC_SEGMENT pieces whose CRCs are joined afterwards, then each blob's data is an item of its own
+typedef struct{
+    const char *map;
+    const StateHeader *header;
+    int meta_pieces;                           // pieces from the end of the header to data_section
+    int pieces;                                // pieces of the tables and the cold section, the blobs follow
+    uint32_t *crcs;                            // CRC of each piece
+    long bad_blobs;                            // blobs whose data does not match its CRC, updated atomically
+}StateCheck;
+
+// the bytes piece k of a state file check covers
+static const char* check_piece(const StateCheck *check, int k, uint64_t *len){
+    const StateHeader *h = check->header;
+    int meta = k < check->meta_pieces;
+    uint64_t start = meta ? sizeof(StateHeader) + (uint64_t)k * CRC_SEGMENT
+                          : h->cold_section + (uint64_t)(k - check->meta_pieces) * CRC_SEGMENT;
+    uint64_t end = meta ? h->data_section : h->cold_section + h->cold_size;
+    *len = end - start < CRC_SEGMENT ? end - start : CRC_SEGMENT;
+    return check->map + start;
+}
+
+// pool job checksumming items begin..end-1 of a state file check
+static void check_state(void *ctx, int begin, int end){
+    StateCheck *check = ctx;
+    const StateHeader *h = check->header;
+    const BlobRecord *blobs = (const BlobRecord *)(check->map + h->blob_table);
+    uint64_t data_len = h->size - h->data_section;
+    for(int k = begin; k < end; k++){
+        if(k < check->pieces){
+            uint64_t len;
+            const char *piece = check_piece(check, k, &len);
+            check->crcs[k] = crc32c(piece, len);
+            continue;
+        }
+        const BlobRecord *rec = &blobs[k - check->pieces];
+        if(rec->data > data_len || rec->stored > data_len - rec->data
+           || crc32c(check->map + h->data_section + rec->data, rec->stored) != rec->crc){
+            __atomic_add_fetch(&check->bad_blobs, 1, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// checks a mapped state file against its checksums on the worker pool: the header and tables and, with content
+// set, the cold section and the data of every blob. Reports each part that does not match and returns their number
+static long state_check(const char *filename, const char *map, int content){
+    const StateHeader *h = (const StateHeader *)map;
+    StateCheck check = {map, h, 0, 0, NULL, 0};
+    check.meta_pieces = (h->data_section - sizeof(StateHeader) + CRC_SEGMENT - 1) / CRC_SEGMENT;
+    check.pieces = check.meta_pieces + (content ? (h->cold_size + CRC_SEGMENT - 1) / CRC_SEGMENT : 0);
+    check.crcs = malloc((check.pieces + 1) * sizeof(uint32_t));
+    if(!check.crcs){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    parallel_for(check.pieces + (content ? (int)h->blob_count : 0), check_state, &check);
+    uint32_t meta_crc = crc32c(h, offsetof(StateHeader, meta_crc)), cold_crc = 0;
+    for(int k = 0; k < check.pieces; k++){
+        uint64_t len;
+        check_piece(&check, k, &len);
+        if(k < check.meta_pieces) meta_crc = crc32c_combine(meta_crc, check.crcs[k], len);
+        else cold_crc = crc32c_combine(cold_crc, check.crcs[k], len);
+    }
+    free(check.crcs);
+    long bad = check.bad_blobs;
+    if(meta_crc != h->meta_crc){
+        fprintf(cmd_err, "Error: %s is corrupt: its tables do not match their checksum\n", filename);
+        bad++;
+    }
+    if(content && cold_crc != h->cold_crc){
+        fprintf(cmd_err, "Error: %s is corrupt: its cold section does not match its checksum\n", filename);
+        bad++;
+    }
+    if(check.bad_blobs){
+        fprintf(cmd_err, "Error: %s is corrupt: %ld of %u contents do not match their checksums\n", filename,
+                check.bad_blobs, h->blob_count);
+    }
+    return bad;
+}
+
+// checks that every reference inside the tables of a mapped state file stays within them: blobs only name
+// earlier blobs and their data lies within the data section, record ranges lie within their tables, pages sit
+// at the position their files' ids give and strings start within the string section. The checksums cannot
+// vouch for this when a load skips the content, as it does unless 'set verify content', or for a file written
+// wrong in the first place.
+// Reports the first problem found and returns 0
+static int state_tables_ok(const char *filename, const char *map){
+    const StateHeader *h = (const StateHeader *)map;
+    const BlobRecord *blobs = (const BlobRecord *)(map + h->blob_table);
+    const uint64_t *name_table = (const uint64_t *)(map + h->name_table);
+    const PageRecord *page_table = (const PageRecord *)(map + h->page_table);
+    const int32_t *page_refs = (const int32_t *)(map + h->page_ref_table);
+    const FileRecord *file_table = (const FileRecord *)(map + h->file_table);
+    const LogRecord *log_table = (const LogRecord *)(map + h->log_table);
+    const FileEvent *event_table = (const FileEvent *)(map + h->event_table);
+    const RollbackRecord *rollback_table = (const RollbackRecord *)(map + h->rollback_table);
+    const SnapshotRecord *snapshot_table = (const SnapshotRecord *)(map + h->snapshot_table);
+    const char *data = map + h->data_section;
+    uint64_t data_len = h->size - h->data_section;
+    uint64_t strings_len = h->data_section - h->string_section;
+    const char *problem = NULL;
+    if(h->string_section > h->data_section || (strings_len && map[h->data_section - 1] != '\0')){
+        problem = "its strings are not terminated";
+    }
+    else if(h->live_pages > h->page_refs){
+        problem = "its live table lies outside the page references";
+    }
+    else if(h->retention < 0 || h->hot_versions < 1){
+        problem = "its version policy is out of range";
+    }
+    for(uint32_t i = 0; i < h->blob_count && !problem; i++){
+        const BlobRecord *rec = &blobs[i];
+        if(rec->data > data_len || rec->stored > data_len - rec->data || rec->codec < 0 || rec->codec >= CODEC_COUNT || rec->base_id < -1 || rec->base_id >= (int64_t)i
+           || rec->chunk_count < 0){
+            problem = "a content record lies outside the file";
+        }
+        else if(rec->chunk_count > 0){
+            uint64_t total = 0;
+            if(rec->base_id >= 0 || rec->stored != (uint64_t)rec->chunk_count * sizeof(int32_t)){
+                problem = "a content record lies outside the file";
+            }
+            for(int k = 0; k < rec->chunk_count && !problem; k++){
+                int32_t id;
+                memcpy(&id, data + rec->data + k * sizeof(int32_t), sizeof(id));
+                if(id < 0 || (uint32_t)id >= i) problem = "a chunk names a content not stored before it";
+                else total += blobs[id].len;
+            }
+            if(!problem && total != rec->len) problem = "a content's chunks do not add up to its length";
+        }
+        else if(rec->base_id < 0 && rec->raw != rec->len){
+            problem = "a content record lies outside the file";
+        }
+    }
+    for(uint32_t i = 0; i < h->name_count && !problem; i++){
+        if(name_table[i] >= strings_len) problem = "a file name lies outside the string section";
+    }
+    // the block of PAGE_FILES ids each page holds, -1 while it holds no file
+    int64_t *blocks = malloc((h->page_count + 1) * sizeof(int64_t));
+    if(!blocks){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    for(uint32_t i = 0; i < h->page_count && !problem; i++){
+        const PageRecord *page = &page_table[i];
+        blocks[i] = -1;
+        if(page->file_count < 0 || page->file_count > PAGE_FILES || page->first_file > h->file_records
+           || (uint64_t)page->file_count > h->file_records - page->first_file){
+            problem = "a page lies outside the file records";
+            break;
+        }
+        for(int j = 0; j < page->file_count && !problem; j++){
+            const FileRecord *rec = &file_table[page->first_file + j];
+            if(rec->id < 0 || (uint32_t)rec->id >= h->name_count
+               || (blocks[i] >= 0 && blocks[i] != rec->id / PAGE_FILES)){
+                problem = "a file record names a file outside its page";
+            }
+            else if(rec->log_count < 1 || rec->cold_count < 0 || rec->first_log > h->log_records
+                    || (uint64_t)rec->log_count > h->log_records - rec->first_log || rec->first_cold > h->cold_refs
+                    || (uint64_t)rec->cold_count > h->cold_refs - rec->first_cold){
+                problem = "a file's versions lie outside the log records";
+            }
+            else if(rec->event_count < 0 || rec->first_event > h->event_records
+                    || (uint64_t)rec->event_count > h->event_records - rec->first_event){
+                problem = "a file's events lie outside the event records";
+            }
+            blocks[i] = rec->id / PAGE_FILES;
+        }
+    }
+    for(uint64_t i = 0; i < h->log_records && !problem; i++){
+        const LogRecord *lrec = &log_table[i];
+        if(lrec->blob_id < 0 || (uint32_t)lrec->blob_id >= h->blob_count){
+            problem = "a version names a content that is not stored";
+        }
+        else if(lrec->comment >= strings_len || lrec->author_name >= strings_len){
+            problem = "a version's note lies outside the string section";
+        }
+    }
+    for(uint64_t i = 0; i < h->event_records && !problem; i++){
+        if(event_table[i].kind < EVENT_CONTENT || event_table[i].kind > EVENT_RECOVER) problem = "a file event is of no known kind";
+    }
+    // the live table's references, then each snapshot's and each rollback's; a page must sit at the position
+    // of its block
+    for(int64_t i = -1; i < (int64_t)(h->snapshot_count + h->rollback_count) && !problem; i++){
+        uint64_t first = 0, count = h->live_pages;
+        if(i >= 0 && i < h->snapshot_count){
+            const SnapshotRecord *rec = &snapshot_table[i];
+            first = rec->first_page;
+            count = rec->page_count;
+            if(rec->tag >= strings_len) problem = "a snapshot tag lies outside the string section";
+            else if(rec->page_count < 0 || first > h->page_refs || count > h->page_refs - first){
+                problem = "a snapshot lies outside the page references";
+            }
+        }
+        else if(i >= 0){
+            const RollbackRecord *rec = &rollback_table[i - h->snapshot_count];
+            first = rec->first_page;
+            count = rec->page_count;
+            if(rec->page_count < 0 || first > h->page_refs || count > h->page_refs - first){
+                problem = "a rollback lies outside the page references";
+            }
+        }
+        for(uint64_t p = 0; p < count && !problem; p++){
+            int32_t ref = page_refs[first + p];
+            if(ref < -1 || (ref >= 0 && (uint32_t)ref >= h->page_count)) problem = "a table names a page not stored";
+            else if(ref >= 0 && blocks[ref] >= 0 && (uint64_t)blocks[ref] != p) problem = "a page sits out of place";
+        }
+    }
+    free(blocks);
+    if(problem){
+        fprintf(cmd_err, "Error: %s is corrupt: %s\n", filename, problem);
+        return 0;
+    }
+    return 1;
+}
+
+// load the file system state from disk
+// the state file is mapped and served in place: names, authors, comments and blob content stay views into
+// the mapping, so loading costs one small record per file and version. Its checksums are checked first on
+// the worker pool, the cold section's and content's too with 'set verify content', and a corrupt file leaves
+// the state as it was; by default those are left to 'verify', so a load costs the tables whatever the size of
+// the content
+int load_from_disk(const char *filename){
+    bgsave_reap(1);
+    size_t map_len;
+    char *map = map_state(filename, &map_len);
+    if(!map) return VFS_IO;
+    if(state_check(filename, map, verify_content) != 0 || !state_tables_ok(filename, map)){
+        munmap(map, map_len);
+        return VFS_IO;
+    }
+    const StateHeader *h = (const StateHeader *)map;
+    free_state();
+    if(state_map) munmap(state_map, state_map_len);
+    state_map = map;
+    state_map_len = map_len;
+    cold_mapped = map + h->cold_section;
+    cold_mapped_len = h->cold_size;
+    cold_spilled = 0;
+    if(cold_fd >= 0 && ftruncate(cold_fd, 0) != 0) print_errno("Error truncating the cold tier");
+
+    const BlobRecord *blob_records = (const BlobRecord *)(map + h->blob_table);
+    const uint64_t *name_table = (const uint64_t *)(map + h->name_table);
+    const PageRecord *page_table = (const PageRecord *)(map + h->page_table);
+    const int32_t *page_refs = (const int32_t *)(map + h->page_ref_table);
+    const FileRecord *file_table = (const FileRecord *)(map + h->file_table);
+    const LogRecord *log_table = (const LogRecord *)(map + h->log_table);
+    const ColdRef *cold_table = (const ColdRef *)(map + h->cold_ref_table);
+    const FileEvent *event_table = (const FileEvent *)(map + h->event_table);
+    const RollbackRecord *rollback_table = (const RollbackRecord *)(map + h->rollback_table);
+    const SnapshotRecord *snapshot_table = (const SnapshotRecord *)(map + h->snapshot_table);
+    const char *strings = map + h->string_section;
+    char *data = map + h->data_section;
+
+    Blob **ids = malloc((h->blob_count + 1) * sizeof(Blob *));
+    if(!ids){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    for(uint32_t i = 0; i < h->blob_count; i++){
+        const BlobRecord *rec = &blob_records[i];
+        Blob *b = malloc(sizeof(Blob));
+        if(!b){
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+        b->hash = rec->hash;
+        b->len = rec->len;
+        b->stored = rec->stored;
+        b->raw = rec->raw;
+        b->codec = rec->codec >= 0 && rec->codec < CODEC_COUNT ? rec->codec : CODEC_NONE;
+        b->data = data + rec->data;
+        b->refs = 0;
+        b->save_id = -1;
+        b->cached = NULL;
+        b->base = rec->base_id >= 0 ? blob_retain(ids[rec->base_id]) : NULL;
+        b->depth = b->base ? b->base->depth + 1 : 0;
+        b->chunks = NULL;
+        b->chunk_count = rec->chunk_count;
+        if(rec->chunk_count > 0){
+            b->chunks = malloc(rec->chunk_count * sizeof(Blob *));
+            if(!b->chunks){
+                fprintf(stderr, "Error: Memory allocation failed\n");
+                exit(EXIT_FAILURE);
+            }
+            for(int k = 0; k < rec->chunk_count; k++){
+                int32_t id;
+                memcpy(&id, b->data + k * sizeof(int32_t), sizeof(id));
+                b->chunks[k] = blob_retain(ids[id]);
+            }
+            b->data = NULL;
+            b->stored = 0;
+        }
+        blob_link(b);
+        ids[i] = b;
+    }
+
+    for(uint32_t i = 0; i < h->name_count; i++){
+        intern_file(strings + name_table[i]);
+    }
+    FilePage **pages = malloc((h->page_count + 1) * sizeof(FilePage *));
+    if(!pages){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    PageLoad load = {page_table, file_table, log_table, cold_table, event_table, strings, ids, pages};
+    parallel_for(h->page_count, load_pages, &load);
+    live = map_table(page_refs, h->live_pages, pages);
+
+    snapshot_count = h->snapshot_count;
+    snapshots = (Snapshot *)malloc(snapshot_count * sizeof(Snapshot));
+    for(int i = 0; i < snapshot_count; i++){
+        const SnapshotRecord *rec = &snapshot_table[i];
+        snapshots[i].tag = (char *)strings + rec->tag;
+        snapshots[i].timestamp = rec->timestamp;
+        snapshots[i].is_obsolete = rec->is_obsolete;
+        snapshots[i].table = map_table(page_refs + rec->first_page, rec->page_count, pages);
+    }
+    rollback_count = h->rollback_count;
+    rollbacks = malloc((rollback_count + 1) * sizeof(Rollback));
+    if(!rollbacks){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    for(int i = 0; i < rollback_count; i++){
+        const RollbackRecord *rec = &rollback_table[i];
+        rollbacks[i] = (Rollback){rec->at, map_table(page_refs + rec->first_page, rec->page_count, pages)};
+    }
+    for(uint32_t i = 0; i < h->page_count; i++){
+        page_release(pages[i]);
+    }
+    free(pages);
+    free(ids);
+    index_rebuild(&snapshot_names, snapshot_count, snapshot_key);
+    retention = h->retention;
+    hot_versions = h->hot_versions;
+
+    journal.len = 0;
+    free(journal_base);
+    journal_base = NULL;
+    long replayed = replay_journal(filename, h->generation);
+    if(replayed >= 0 && journal_mode){
+        journal_base = strdup(filename);
+        journal_base_size = map_len;
+    }
+    if(replayed > 0){
+        fprintf(cmd_out, "Data successfully loaded from %s (%ld journal records replayed)\n", filename, replayed);
+        return VFS_OK;
+    }
+    fprintf(cmd_out, "Data successfully loaded from %s\n", filename);
+    return VFS_OK;
+}
+
+// checks every checksum of a state file without loading it
+int verify_state(const char *filename){
+    bgsave_reap(1);
+    size_t map_len;
+    uint64_t start = clock_ns();
+    char *map = map_state(filename, &map_len);
+    if(!map) return VFS_IO;
+    const StateHeader *h = (const StateHeader *)map;
+    uint32_t blobs = h->blob_count;
+    long bad = state_check(filename, map, 1);
+    if(!bad && !state_tables_ok(filename, map)) bad = 1;
+    munmap(map, map_len);
+    if(bad) return VFS_IO;
+    double seconds = (clock_ns() - start) / 1e9;
+    fprintf(cmd_out, "Verified %s: tables, cold section and %u contents match their checksums (%.1f MB in %.3f s, %.2f GB/s)\n",
+            filename, blobs, map_len / 1e6, seconds, seconds > 0 ? map_len / 1e9 / seconds : 0.0);
+    return VFS_OK;
+}
+
+// what a pool job checking the store in memory works on: every blob, then every distinct cold version
+typedef struct{
+    Blob **blobs;
+    long blob_count;
+    const ColdRef *cold;
+    long cold_count;
+    char *bad;                                 // set for each item whose content does not hash to its address
+}StoreCheck;
+
+// pool job rebuilding the content of items begin..end-1 of a store check and hashing it
+static void check_store(void *ctx, int begin, int end){
+    StoreCheck *check = ctx;
+    for(int k = begin; k < end; k++){
+        if(k < check->blob_count){
+            Blob *b = check->blobs[k];
+            const char *content = blob_build(b, 0);
+            check->bad[k] = hash_bytes(content, b->len) != b->hash;
+            blob_put(b, content);
+            continue;
+        }
+        const ColdRef *ref = &check->cold[k - check->blob_count];
+        ColdEntry entry;
+        check->bad[k] = 1;
+        if(cold_read(ref->ref, &entry, 1) == 0){
+            check->bad[k] = hash_bytes(entry.content, entry.rec.len) != ref->hash;
+            cold_entry_free(&entry);
+        }
+    }
+}
+
+// checks the store in memory on the worker pool: every blob and every version in the cold tier is rebuilt
+// (deltas applied, chunks joined, codecs undone) and must hash to the address it is kept under
+int verify_store(){
+    uint64_t start = clock_ns(), bytes = 0;
+    Blob **blobs = malloc((blob_count + 1) * sizeof(Blob *));
+    if(!blobs){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    long count = 0;
+    for(size_t i = 0; i < blob_buckets; i++){
+        for(Blob *b = blob_table[i]; b; b = b->next){
+            blobs[count++] = b;
+            bytes += b->len;
+        }
+    }
+    size_t page_count;
+    FilePage **pages = state_pages(&page_count);
+    Buffer cold = {NULL, 0, 0};
+    for(size_t p = 0; p < page_count; p++){
+        for(uint64_t used = pages[p]->used; used; used &= used - 1){
+            const File *file = &pages[p]->files[__builtin_ctzll(used)];
+            if(file->cold_count) buffer_append(&cold, file->cold, file->cold_count * sizeof(ColdRef));
+        }
+    }
+    free(pages);
+    // snapshots share versions, each record is read once; a ColdRef starts with its reference
+    long cold_count = cold.len / sizeof(ColdRef), kept = 0;
+    ColdRef *refs = (ColdRef *)cold.data;
+    if(cold_count) qsort(refs, cold_count, sizeof(ColdRef), compare_u64);
+    for(long i = 0; i < cold_count; i++){
+        if(i == 0 || refs[i].ref != refs[i - 1].ref) refs[kept++] = refs[i];
+    }
+    StoreCheck check = {blobs, count, refs, kept, calloc(count + kept + 1, 1)};
+    if(!check.bad){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    parallel_for(count + kept, check_store, &check);
+    long bad = 0;
+    for(long k = 0; k < count + kept; k++){
+        if(!check.bad[k]) continue;
+        if(k < count) fprintf(cmd_err, "Error: Content %016llx does not match its hash\n", (unsigned long long)blobs[k]->hash);
+        else fprintf(cmd_err, "Error: Cold version %016llx does not match its hash\n", (unsigned long long)refs[k - count].hash);
+        bad++;
+    }
+    free(check.bad);
+    free(cold.data);
+    free(blobs);
+    if(bad) return VFS_IO;
+    double seconds = (clock_ns() - start) / 1e9;
+    fprintf(cmd_out, "Verified the store: %ld contents and %ld cold versions match their hashes (%.1f MB in %.3f s, %.2f GB/s)\n",
+            count, kept, bytes / 1e6, seconds, seconds > 0 ? bytes / 1e9 / seconds : 0.0);
+    return VFS_OK;
+}
+
+// allocates count elements of size bytes, zeroed
+static void* diff_alloc(size_t count, size_t size){
+    void *p = calloc(count ? count : 1, size);
+    if(!p){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+// splits a text into lines and hashes them; newlines are found 16 bytes at a time where SSE2 is available
+static void diff_side(DiffSide *side, const char *text, size_t len){
+    size_t cap = len / 32 + 16, count = 0;
+    size_t *start = malloc(cap * sizeof(size_t));
+    if(!start){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    start[count++] = 0;
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i newline = _mm_set1_epi8('\n');
+    for(; i + 16 <= len; i += 16){
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(text + i)), newline));
+        while(mask){
+            if(count + 2 > cap){
+                cap *= 2;
+                start = realloc(start, cap * sizeof(size_t));
+                if(!start){
+                    fprintf(stderr, "Error: Memory allocation failed\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            start[count++] = i + __builtin_ctz(mask) + 1;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for(; i < len; i++){
+        if(text[i] != '\n') continue;
+        if(count + 2 > cap){
+            cap *= 2;
+            start = realloc(start, cap * sizeof(size_t));
+            if(!start){
+                fprintf(stderr, "Error: Memory allocation failed\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        start[count++] = i + 1;
+    }
+    if(start[count - 1] != len) start[count++] = len;
+    side->text = text;
+    side->start = start;
+    side->count = count - 1;
+    side->hash = diff_alloc(side->count, sizeof(uint64_t));
+    side->id = diff_alloc(side->count, sizeof(int));
+    side->changed = diff_alloc(side->count, 1);
+    for(long k = 0; k < side->count; k++){
+        side->hash[k] = hash_bytes(text + start[k], start[k + 1] - start[k]);
+    }
+}
+
+// frees what diff_side allocated
+static void diff_side_free(DiffSide *side){
+    free(side->start);
+    free(side->hash);
+    free(side->id);
+    free(side->changed);
+}
+
+// whether line i of a and line j of b are the same
+static int diff_line_equal(const DiffSide *a, long i, const DiffSide *b, long j){
+    size_t len = a->start[i + 1] - a->start[i];
+    return a->hash[i] == b->hash[j] && len == b->start[j + 1] - b->start[j]
+        && memcmp(a->text + a->start[i], b->text + b->start[j], len) == 0;
+}
+
+// finds a point on an edit path of a[xoff..xlim) to b[yoff..ylim) that splits it into two smaller problems
+// runs the Myers search from both ends until they overlap, or settles for the furthest forward point once
+// the edit cost passes the limit
+static void diff_split(DiffSearch *s, long xoff, long xlim, long yoff, long ylim, long *split_x, long *split_y){
+    const int *a = s->a, *b = s->b;
+    long *fd = s->fd, *bd = s->bd;
+    long dmin = xoff - ylim, dmax = xlim - yoff;
+    long fmid = xoff - yoff, bmid = xlim - ylim;
+    long fmin = fmid, fmax = fmid, bmin = bmid, bmax = bmid;
+    int odd = (fmid - bmid) & 1;
+    fd[fmid] = xoff;
+    bd[bmid] = xlim;
+    for(long cost = 1;; cost++){
+        if(fmin > dmin) fd[--fmin - 1] = -1;
+        else fmin++;
+        if(fmax < dmax) fd[++fmax + 1] = -1;
+        else fmax--;
+        for(long d = fmax; d >= fmin; d -= 2){
+            long lo = fd[d - 1], hi = fd[d + 1];
+            long x = lo >= hi ? lo + 1 : hi, y = x - d;
+            while(x < xlim && y < ylim && a[x] == b[y]){
+                x++;
+                y++;
+            }
+            fd[d] = x;
+            if(odd && bmin <= d && d <= bmax && bd[d] <= x){
+                *split_x = x;
+                *split_y = y;
+                return;
+            }
+        }
+        if(bmin > dmin) bd[--bmin - 1] = LONG_MAX;
+        else bmin++;
+        if(bmax < dmax) bd[++bmax + 1] = LONG_MAX;
+        else bmax--;
+        for(long d = bmax; d >= bmin; d -= 2){
+            long lo = bd[d - 1], hi = bd[d + 1];
+            long x = lo < hi ? lo : hi - 1, y = x - d;
+            while(x > xoff && y > yoff && a[x - 1] == b[y - 1]){
+                x--;
+                y--;
+            }
+            bd[d] = x;
+            if(!odd && fmin <= d && d <= fmax && x <= fd[d]){
+                *split_x = x;
+                *split_y = y;
+                return;
+            }
+        }
+        if(cost >= s->limit){
+            long best = -1;
+            for(long d = fmax; d >= fmin; d -= 2){
+                long x = fd[d] < xlim ? fd[d] : xlim, y = x - d;
+                if(y > ylim){
+                    x = ylim + d;
+                    y = ylim;
+                }
+                if(x + y > best){
+                    best = x + y;
+                    *split_x = x;
+                    *split_y = y;
+                }
+            }
+            return;
+        }
+    }
+}
+
+// marks the lines of a[xoff..xlim) and b[yoff..ylim) that are not on a shortest (or good enough) edit path
+static void diff_compare(DiffSearch *s, long xoff, long xlim, long yoff, long ylim){
+    for(;;){
+        while(xoff < xlim && yoff < ylim && s->a[xoff] == s->b[yoff]){
+            xoff++;
+            yoff++;
+        }
+        while(xlim > xoff && ylim > yoff && s->a[xlim - 1] == s->b[ylim - 1]){
+            xlim--;
+            ylim--;
+        }
+        if(xoff == xlim || yoff == ylim) break;
+        long x = xoff, y = yoff;
+        diff_split(s, xoff, xlim, yoff, ylim, &x, &y);
+        if((x == xoff && y == yoff) || (x == xlim && y == ylim)) break;
+        diff_compare(s, xoff, x, yoff, y);
+        xoff = x;
+        yoff = y;
+    }
+    memset(s->ca + xoff, 1, xlim - xoff);
+    memset(s->cb + yoff, 1, ylim - yoff);
+}
+
+// marks the changed lines of both sides
+// the common prefix and suffix are skipped first, the lines in between get ids (equal lines, equal ids)
+// so the search compares integers
+static void diff_run(DiffSide *a, DiffSide *b){
+    long pre = 0, suf = 0;
+    while(pre < a->count && pre < b->count && diff_line_equal(a, pre, b, pre)) pre++;
+    while(suf < a->count - pre && suf < b->count - pre
+          && diff_line_equal(a, a->count - 1 - suf, b, b->count - 1 - suf)) suf++;
+    long n = a->count - pre - suf, m = b->count - pre - suf;
+    if(n == 0 || m == 0){
+        memset(a->changed + pre, 1, n);
+        memset(b->changed + pre, 1, m);
+        return;
+    }
+
+    size_t cap = 64;
+    while(cap < (size_t)(n + m) * 2) cap *= 2;
+    DiffSlot *slots = malloc(cap * sizeof(DiffSlot));
+    if(!slots){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(slots, 0xff, cap * sizeof(DiffSlot));
+    int next_id = 0;
+    for(long k = 0; k < n + m; k++){
+        if(k + DIFF_PREFETCH < n + m){
+            long ahead = k + DIFF_PREFETCH;
+            const DiffSide *ahead_side = ahead < n ? a : b;
+            __builtin_prefetch(&slots[ahead_side->hash[pre + (ahead < n ? ahead : ahead - n)] & (cap - 1)], 1);
+        }
+        DiffSide *side = k < n ? a : b;
+        long line = pre + (k < n ? k : k - n);
+        uint32_t check = side->hash[line] >> 32;
+        size_t pos = side->hash[line] & (cap - 1);
+        for(;; pos = (pos + 1) & (cap - 1)){
+            if(slots[pos].ref < 0){
+                slots[pos].check = check;
+                slots[pos].ref = k;
+                side->id[line] = next_id++;
+                break;
+            }
+            if(slots[pos].check != check) continue;
+            long other = slots[pos].ref;
+            DiffSide *other_side = other < n ? a : b;
+            long other_line = pre + (other < n ? other : other - n);
+            if(diff_line_equal(side, line, other_side, other_line)){
+                side->id[line] = other_side->id[other_line];
+                break;
+            }
+        }
+    }
+    free(slots);
+
+    // lines without a match on the other side are changed whatever the search finds, so only
+    // the others are searched; with scattered edits that leaves sequences differing in few places
+    long *count = diff_alloc(next_id, sizeof(long) * 2);
+    for(long k = 0; k < n; k++) count[2 * a->id[pre + k]]++;
+    for(long k = 0; k < m; k++) count[2 * b->id[pre + k] + 1]++;
+    long *map_a = diff_alloc(n, sizeof(long)), *map_b = diff_alloc(m, sizeof(long));
+    int *ids_a = diff_alloc(n, sizeof(int)), *ids_b = diff_alloc(m, sizeof(int));
+    long kept_a = 0, kept_b = 0;
+    for(long k = 0; k < n; k++){
+        if(count[2 * a->id[pre + k] + 1]){
+            map_a[kept_a] = pre + k;
+            ids_a[kept_a++] = a->id[pre + k];
+        }
+        else a->changed[pre + k] = 1;
+    }
+    for(long k = 0; k < m; k++){
+        if(count[2 * b->id[pre + k]]){
+            map_b[kept_b] = pre + k;
+            ids_b[kept_b++] = b->id[pre + k];
+        }
+        else b->changed[pre + k] = 1;
+    }
+    free(count);
+
+    DiffSearch search;
+    search.a = ids_a;
+    search.b = ids_b;
+    search.ca = diff_alloc(kept_a, 1);
+    search.cb = diff_alloc(kept_b, 1);
+    search.fd = (long *)diff_alloc(kept_a + kept_b + 3, sizeof(long)) + kept_b + 1;
+    search.bd = (long *)diff_alloc(kept_a + kept_b + 3, sizeof(long)) + kept_b + 1;
+    search.limit = 1;
+    for(long diagonals = kept_a + kept_b + 3; diagonals; diagonals >>= 2) search.limit <<= 1;
+    if(search.limit < DIFF_MIN_COST) search.limit = DIFF_MIN_COST;
+    diff_compare(&search, 0, kept_a, 0, kept_b);
+    for(long k = 0; k < kept_a; k++) a->changed[map_a[k]] = search.ca[k];
+    for(long k = 0; k < kept_b; k++) b->changed[map_b[k]] = search.cb[k];
+    free(search.fd - kept_b - 1);
+    free(search.bd - kept_b - 1);
+    free(search.ca);
+    free(search.cb);
+    free(map_a);
+    free(map_b);
+    free(ids_a);
+    free(ids_b);
+}
+
+// writes lines from..to-1 of a side, each behind a one character marker
+static void diff_print_lines(const DiffSide *side, long from, long to, char marker){
+    for(long k = from; k < to; k++){
+        size_t len = side->start[k + 1] - side->start[k];
+        fputc(marker, cmd_out);
+        fwrite(side->text + side->start[k], 1, len, cmd_out);
+        if(len == 0 || side->text[side->start[k] + len - 1] != '\n') fputs("\n\\ No newline at end of file\n", cmd_out);
+    }
+}
+
+// writes the changes between two marked sides as unified diff hunks, returns the number of hunks
+static long diff_print(const DiffSide *a, const DiffSide *b){
+    long i = 0, j = 0, hunks = 0;
+    while(i < a->count || j < b->count){
+        if((i < a->count && a->changed[i]) || (j < b->count && b->changed[j])){
+            // a hunk runs from DIFF_CONTEXT lines before this change to DIFF_CONTEXT lines after the last change
+            // that is at most 2 * DIFF_CONTEXT unchanged lines from the previous one
+            long hi = i, hj = j, ei = i, ej = j;
+            for(;;){
+                while(ei < a->count && a->changed[ei]) ei++;
+                while(ej < b->count && b->changed[ej]) ej++;
+                long gap = 0;
+                while(ei + gap < a->count && ej + gap < b->count && !a->changed[ei + gap] && !b->changed[ej + gap]
+                      && gap <= 2 * DIFF_CONTEXT) gap++;
+                int more = (ei + gap < a->count && a->changed[ei + gap]) || (ej + gap < b->count && b->changed[ej + gap]);
+                if(!more || gap > 2 * DIFF_CONTEXT) break;
+                ei += gap;
+                ej += gap;
+            }
+            long before = hi < DIFF_CONTEXT ? hi : DIFF_CONTEXT;
+            long after = DIFF_CONTEXT;
+            if(a->count - ei < after) after = a->count - ei;
+            long si = hi - before, sj = hj - before, ti = ei + after, tj = ej + after;
+            fprintf(cmd_out, "@@ -%ld,%ld +%ld,%ld @@\n", ti > si ? si + 1 : si, ti - si, tj > sj ? sj + 1 : sj, tj - sj);
+            long x = si, y = sj;
+            while(x < ti || y < tj){
+                if(x < ti && a->changed[x]){
+                    long end = x;
+                    while(end < ti && a->changed[end]) end++;
+                    diff_print_lines(a, x, end, '-');
+                    x = end;
+                }
+                else if(y < tj && b->changed[y]){
+                    long end = y;
+                    while(end < tj && b->changed[end]) end++;
+                    diff_print_lines(b, y, end, '+');
+                    y = end;
+                }
+                else{
+                    diff_print_lines(a, x, x + 1, ' ');
+                    x++;
+                    y++;
+                }
+            }
+            hunks++;
+            i = ti;
+            j = tj;
+        }
+        else{
+            i++;
+            j++;
+        }
+    }
+    return hunks;
+}
+
+// deleting the log for the file in FIFO manner, the oldest version goes whether it is cold or hot
+int delete_log(const char *name){
+    int i = find_file(name);
+    if(i >= 0 && table_file(live, i)->log_count > 0){
+        FilePage *page = live_page(i);
+        File *file = &page->files[i % PAGE_FILES];
+        if(file->cold_count){
+            cold_reserve(file);
+            memmove(file->cold, file->cold + 1, --file->cold_count * sizeof(ColdRef));
+        }
+        else{
+            forget_log(page, &file->log_history[0]);
+            memmove(file->log_history, file->log_history + 1, --file->hot_count * sizeof(LogEntry));
+        }
+        file->log_count--;
+        if(file_timed(file)) event_prune(file);
+        page_sync(page, i % PAGE_FILES);
+        fprintf(cmd_out, "Deleted log of file %s using FIFO policy.\n", name); 
+        return VFS_OK;
+    }
+    fprintf(cmd_out, "File %s not found.\n", name);  
+    return VFS_NOT_FOUND;
+}
+
+// makes content, a blob reference handed over by the caller, the newest version of file i, or the first
+// version of a new file with this name when i is -1
+static void add_version(int i, const char *name, Blob *content, const char *author_name, const char *note){
+    if(i >= 0){
+        FilePage *page = live_page(i);
+        File *file = &page->files[i % PAGE_FILES];
+        LogEntry new_log;
+        new_log.content = content;
+        new_log.timestamp = now();
+        while(retention && file->log_count >= retention){
+            delete_log(name);
+        }
+        new_log.comment = arena_strdup(&page->arena, note);
+        new_log.author_name = arena_strdup(&page->arena, author_name);
+        new_log.version_id = file->log_count + 1;
+        *hot_push(file) = new_log;
+        if(file_timed(file)) event_push(file, new_log.timestamp, EVENT_CONTENT, content->hash);
+        spill_versions(page, file);
+        page_sync(page, i % PAGE_FILES);
+        compact_page(page);
+        is_change = 1;
+        return;
+    }
+    i = intern_file(name);
+    FilePage *page = live_page(i);
+    File *file = &page->files[i % PAGE_FILES];
+    page->used |= 1ULL << (i % PAGE_FILES);
+    page->deleted &= ~(1ULL << (i % PAGE_FILES));
+    file->log_count = 0;
+    file->cold = NULL;
+    file->cold_count = file->cold_cap = 0;
+    file->events = NULL;
+    file->event_count = 0;
+    hot_init(file, 1);
+    LogEntry *log = hot_push(file);
+    log->content = content;
+    log->comment = arena_strdup(&page->arena, note);
+    log->author_name = arena_strdup(&page->arena, author_name);
+    log->timestamp = now();
+    log->version_id = 1;
+    page_sync(page, i % PAGE_FILES);
+    is_change = 1;
+}
+
+// adds a new version of a file from content already in memory (taking ownership of the malloc'd buffer)
+int add_content(const char *name, char *content, size_t len, const char *author_name, const char *note){
+    int i = find_file(name);
+    if(table_deleted(live, i)){
+        fprintf(cmd_err, "Error: Failed to update. File %s already exists and currently unavailable.\n", name);
+        free(content);
+        return VFS_CONFLICT;
+    }
+    journal_append(J_ADD, 0, name, author_name, note, content, len);
+    if(search_ready) search_add(hash_bytes(content, len), content, len);
+    Blob *prev = i >= 0 ? file_latest(table_file(live, i))->content : NULL;
+    add_version(i, name, blob_adopt_delta(content, len, prev), author_name, note);
+    fprintf(cmd_out, i >= 0 ? "File %s updated successfully.\n" : "File %s added successfully.\n", name);
+    return VFS_OK;
+}
+
+// reads a whole source file into one malloc'd buffer, retrying short and interrupted reads
+// regular files are read into a single allocation sized from fstat, other sources grow in READ_CHUNK steps
+static char* read_source(int fd, size_t *len){
+    struct stat st;
+    size_t cap = READ_CHUNK;
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) cap = (size_t)st.st_size + 1;
+    char *buf = malloc(cap);
+    size_t used = 0;
+    while(buf){
+        if(used == cap){
+            cap *= 2;
+            char *grown = realloc(buf, cap);
+            if(!grown){
+                free(buf);
+                return NULL;
+            }
+            buf = grown;
+        }
+        ssize_t n = io_read(fd, buf + used, cap - used);
+        if(n == 0) break;
+        if(n < 0){
+            if(errno == EINTR) continue;
+            free(buf);
+            return NULL;
+        }
+        used += n;
+    }
+    *len = used;
+    return buf;
+}
+
+// adding a new file in the file system
+int add_file(const char *name, const char *file_name, const char *author_name, const char *note){
+    int fd = io_open(file_name, O_RDONLY, 0);
+    if(fd == -1){
+        fprintf(cmd_err, "Error: File could not be opened.\n");
+        return VFS_IO;
+    }
+    size_t len;
+    char *content = read_source(fd, &len);
+    close(fd);
+    if(content == NULL){
+        fprintf(cmd_err, "Error: File couldn't be read.\n");
+        return VFS_IO;
+    }
+    return add_content(name, content, len, author_name, note);
+}
+
+// adds the regular files below dir (path, a buffer of 4096 bytes) to entries, named by their path below the
+// imported directory (which starts at path + skip); symbolic links are not followed. Returns -1 when dir
+// cannot be read
+static int import_walk(char *path, size_t skip, Buffer *entries){
+    DIR *dir = opendir(path);
+    if(!dir) return -1;
+    io_count(IO_OPEN, 0);
+    size_t len = strlen(path);
+    struct dirent *d;
+    while((d = readdir(dir))){
+        if(strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) continue;
+        if(len + 1 + strlen(d->d_name) >= 4096) continue;
+        snprintf(path + len, 4096 - len, "/%s", d->d_name);
+        int type = d->d_type;
+        struct stat st;
+        if(type == DT_UNKNOWN && lstat(path, &st) == 0) type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_LNK;
+        if(type == DT_DIR){
+            if(import_walk(path, skip, entries) != 0) fprintf(cmd_err, "Error: Directory %s could not be read\n", path);
+        }
+        else if(type == DT_REG){
+            ImportEntry e = {strdup(path + skip), NULL, 0, 0, 0, NULL};
+            if(!e.name){
+                fprintf(stderr, "Error: Memory allocation failed\n");
+                exit(EXIT_FAILURE);
+            }
+            buffer_append(entries, &e, sizeof(e));
+        }
+        path[len] = '\0';
+    }
+    closedir(dir);
+    return 0;
+}
+
+// orders import entries by name
+static int compare_import(const void *a, const void *b){
+    return strcmp(((const ImportEntry *)a)->name, ((const ImportEntry *)b)->name);
+}
+
+// what an import job works on: its batch of entries and the directory their names are relative to
+typedef struct{
+    ImportEntry *entries;
+    const char *dir;
+}ImportBatch;
+
+// pool job reading and hashing entries begin..end-1 of a batch
+static void import_read(void *ctx, int begin, int end){
+    ImportBatch *batch = ctx;
+    char path[4096];
+    for(int k = begin; k < end; k++){
+        ImportEntry *e = &batch->entries[k];
+        snprintf(path, sizeof(path), "%s/%s", batch->dir, e->name);
+        int fd = io_open(path, O_RDONLY, 0);
+        if(fd == -1) continue;
+        e->text = read_source(fd, &e->len);
+        close(fd);
+        if(e->text) e->hash = hash_bytes(e->text, e->len);
+    }
+}
+
+// orders import entries by content hash, then by position
+static int compare_import_hash(const void *a, const void *b){
+    const ImportEntry *x = *(ImportEntry *const *)a, *y = *(ImportEntry *const *)b;
+    if(x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+    return x < y ? -1 : x > y;
+}
+
+// marks the entries of a batch whose content an earlier entry of it has, so each content is packed once
+static void import_mark_dups(ImportEntry *entries, int count){
+    ImportEntry **order = malloc(count * sizeof(ImportEntry *));
+    if(!order){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    int n = 0;
+    for(int k = 0; k < count; k++){
+        if(entries[k].text) order[n++] = &entries[k];
+    }
+    qsort(order, n, sizeof(ImportEntry *), compare_import_hash);
+    for(int k = 1; k < n; k++){
+        for(int j = k - 1; j >= 0 && order[j]->hash == order[k]->hash; j--){
+            if(!order[j]->dup && order[j]->len == order[k]->len && memcmp(order[j]->text, order[k]->text, order[k]->len) == 0){
+                order[k]->dup = 1;
+                break;
+            }
+        }
+    }
+    free(order);
+}
+
+// pool job building blobs for the contents of entries begin..end-1 that are not stored yet; the blob store
+// and file table are only read here, the commit on the calling thread changes them
+static void import_pack(void *ctx, int begin, int end){
+    ImportBatch *batch = ctx;
+    for(int k = begin; k < end; k++){
+        ImportEntry *e = &batch->entries[k];
+        if(!e->text || e->dup || e->len >= CHUNK_FILE_MIN || blob_find(e->hash, e->text, e->len)) continue;
+        int id = find_file(e->name);
+        const File *file = table_deleted(live, id) ? NULL : table_file(live, id);
+        char *copy = malloc(e->len + 1);
+        if(!copy){
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(copy, e->text, e->len);
+        e->blob = blob_new(copy, e->len, e->hash, file ? file_latest(file)->content : NULL);
+    }
+}
+
+int create_snapshot(const char *tag);
+
+// adds every regular file below a directory as one change: readers on the worker pool read, hash and pack
+// the files IMPORT_BATCH at a time and the calling thread commits each batch in name order. A file whose
+// content equals its current version is left alone; with a tag, a snapshot is taken at the end
+int import_directory(const char *dir, const char *author_name, const char *note, const char *tag){
+    char path[4096];
+    snprintf(path, sizeof(path), "%s", dir);
+    size_t skip = strlen(path);
+    while(skip > 1 && path[skip - 1] == '/') path[--skip] = '\0';
+    Buffer list = {NULL, 0, 0};
+    uint64_t start = clock_ns();
+    if(import_walk(path, skip + 1, &list) != 0){
+        print_errno("Error opening directory");
+        return VFS_IO;
+    }
+    ImportEntry *entries = (ImportEntry *)list.data;
+    long count = list.len / sizeof(ImportEntry), added = 0, updated = 0, unchanged = 0, failed = 0;
+    uint64_t bytes = 0;
+    if(count) qsort(entries, count, sizeof(ImportEntry), compare_import);
+    path[skip] = '\0';
+    for(long first = 0; first < count; first += IMPORT_BATCH){
+        int size = count - first < IMPORT_BATCH ? (int)(count - first) : IMPORT_BATCH;
+        ImportBatch batch = {entries + first, path};
+        parallel_for(size, import_read, &batch);
+        import_mark_dups(batch.entries, size);
+        parallel_for(size, import_pack, &batch);
+        for(int k = 0; k < size; k++){
+            ImportEntry *e = &batch.entries[k];
+            int i = find_file(e->name);
+            Blob *prev = i >= 0 ? file_latest(table_file(live, i))->content : NULL;
+            Blob *b = e->text ? blob_find(e->hash, e->text, e->len) : NULL;
+            if(e->text) bytes += e->len;
+            if(!e->text){
+                fprintf(cmd_err, "Error: %s/%s could not be read\n", path, e->name);
+                failed++;
+            }
+            else if(table_deleted(live, i)){
+                fprintf(cmd_err, "Error: Failed to update. File %s already exists and currently unavailable.\n", e->name);
+                failed++;
+            }
+            else if(b && b == prev){
+                unchanged++;
+            }
+            else{
+                journal_append(J_ADD, 0, e->name, author_name, note, e->text, e->len);
+                if(search_ready) search_add(e->hash, e->text, e->len);
+                if(b){
+                    b->refs++;
+                }
+                else if(e->blob){
+                    blob_link(b = e->blob);
+                    e->blob = NULL;
+                }
+                else{
+                    // chunked content, or content stored when it was read that an earlier commit has dropped
+                    b = blob_adopt_delta(e->text, e->len, prev);
+                    e->text = NULL;
+                }
+                add_version(i, e->name, b, author_name, note);
+                if(i >= 0) updated++;
+                else added++;
+            }
+            if(e->blob) blob_discard(e->blob);
+            free(e->text);
+            free(e->name);
+        }
+    }
+    free(entries);
+    double seconds = (clock_ns() - start) / 1e9;
+    fprintf(cmd_out, "Imported %s: %ld added, %ld updated, %ld unchanged, %ld failed (%.1f MB in %.3f s, %.0f files/s, %.1f MB/s)\n",
+            path, added, updated, unchanged, failed, bytes / 1e6, seconds, seconds > 0 ? (count - failed) / seconds : 0.0,
+            seconds > 0 ? bytes / 1e6 / seconds : 0.0);
+    if(tag && added + updated > 0){
+        int status = create_snapshot(tag);
+        if(status != VFS_OK) return status;
+    }
+    return failed ? VFS_IO : VFS_OK;
+}
+
+// prints the current state of the file system
+// only the used and deleted masks of each page are read, and names go out without format parsing
+int view_fileSystem(){
+    for(int p = 0; live && p < live->page_count; p++){
+        const FilePage *page = live->pages[p];
+        for(uint64_t shown = page ? page->used & ~page->deleted : 0; shown; shown &= shown - 1){
+            fputs_unlocked("File name:     ", cmd_out);
+            fputs_unlocked(file_names[p * PAGE_FILES + __builtin_ctzll(shown)], cmd_out);
+            putc_unlocked('\n', cmd_out);
+        }
+    }
+    return VFS_OK;
+}
+
+// read the file content
+int view_fileContent(const char* filename){
+    int i = find_file(filename);
+    File *file = table_file(live, i);
+    if(file){
+        if(table_deleted(live, i)){
+            fprintf(cmd_err, "Error: File '%s' is currently unavailable. Use 'recover' to restore.\n", filename);
+            return VFS_CONFLICT;
+        }
+        Blob *blob = file_latest(file)->content;
+        const char *content = blob_get(blob);
+        fwrite(content, 1, blob->len, cmd_out);
+        fprintf(cmd_out, "\n\n");
+        blob_put(blob, content);
+        return VFS_OK;
+    }
+    fprintf(cmd_out, "File not found.\n");
+    return VFS_NOT_FOUND;
+}
+
+// taking snapshot at the current time instance
+int create_snapshot(const char *tag){ 
+    if(!is_change){
+        fprintf(cmd_out, "Already the latest file system version.\n");
+        return VFS_CONFLICT;
+    }
+    if(find_snapshot(tag) >= 0){
+        fprintf(cmd_err, "Error: Snapshot with tag '%s' already exists\n", tag);   
+        return VFS_CONFLICT;
+    }
+    snapshots = realloc(snapshots, (snapshot_count + 1)*sizeof(Snapshot));
+    if (!snapshots) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        
+        exit(EXIT_FAILURE);
+    }
+    Snapshot *snapshot = &snapshots[snapshot_count++];
+    snapshot->table = table_retain(live);
+    snapshot->timestamp = now();
+    snapshot->tag = strdup(tag);
+    snapshot->is_obsolete = 0;
+    index_insert(&snapshot_names, snapshot_key, snapshot_count - 1);
+    is_change = 0;
+    journal_append(J_SNAPSHOT, 0, tag, NULL, NULL, NULL, 0);
+    fprintf(cmd_out, "Snapshot '%s' created successfully.\n", tag);
+    return VFS_OK;
+}
+
+//  reverts the file system to a specified snapshot based on its index
+int rollback(int snapshot_index){
+    if(snapshot_index < 0 || snapshot_index >= snapshot_count){
+        fprintf(cmd_err, "Error: Invalid snapshot index\n");
+        return VFS_NOT_FOUND;
+    }
+
+    if(snapshots[snapshot_index].is_obsolete){
+        fprintf(cmd_err, "Error: Referred snapshot index %d is obsolete\n", snapshot_index);
+        return VFS_CONFLICT;
+    }
+
+    rollbacks = realloc(rollbacks, (rollback_count + 1) * sizeof(Rollback));
+    if(!rollbacks){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    // the replaced tree keeps the live reference, so as-of reads of the times before still see its histories
+    time_t at = now();
+    if(rollback_count && at < rollbacks[rollback_count - 1].at) at = rollbacks[rollback_count - 1].at;
+    rollbacks[rollback_count++] = (Rollback){at, live};
+    live = table_retain(snapshots[snapshot_index].table);
+
+    journal_append(J_ROLLBACK, snapshot_index, NULL, NULL, NULL, NULL, 0);
+    fprintf(cmd_out, "Rolled back to snapshot index %d successfully.\n", snapshot_index);
+    return VFS_OK;
+}
+
+// recover back the obsolete snapshot
+int recover_snapshot(int snapshot_index){
+    if(snapshot_index < 0 || snapshot_index >= snapshot_count){
+        fprintf(cmd_err, "Error: Invalid snapshot index\n");
+        return VFS_NOT_FOUND;
+    }
+
+    if(!snapshots[snapshot_index].is_obsolete){
+        fprintf(cmd_err, "Snapshot %d is already Active\n", snapshot_index);
+        return VFS_CONFLICT;
+    }
+    
+    snapshots[snapshot_index].is_obsolete = 0;
+    journal_append(J_RECOVERSNAP, snapshot_index, NULL, NULL, NULL, NULL, 0);
+    fprintf(cmd_out, "Snapshot %d is successfully recovered\n", snapshot_index);
+    return VFS_OK;
+}
+
+// delete file from the file system
+int delete_file(const char *name){
+    int i = find_file(name);
+    if(table_present(live, i)){
+        FilePage *page = live_page(i);
+        page->deleted |= 1ULL << (i % PAGE_FILES);
+        event_push(&page->files[i % PAGE_FILES], now(), EVENT_DELETE, 0);
+        is_change = 1;
+        journal_append(J_DELETE, 0, name, NULL, NULL, NULL, 0);
+        fprintf(cmd_out, "File %s deleted successfully.\n", name);
+        
+        return VFS_OK;
+    }
+    fprintf(cmd_out, "File %s not found.\n", name);  
+    return VFS_NOT_FOUND;
+}
+
+// recover a deleted file by its name
+int recover_file(const char *name){
+    int i = find_file(name);
+    if(table_deleted(live, i)){
+        FilePage *page = live_page(i);
+        page->deleted &= ~(1ULL << (i % PAGE_FILES));
+        event_push(&page->files[i % PAGE_FILES], now(), EVENT_RECOVER, 0);
+        is_change = 1;
+        journal_append(J_RECOVER, 0, name, NULL, NULL, NULL, 0);
+        fprintf(cmd_out, "File %s recovered successfully.\n", name);
+        return VFS_OK;
+    }
+    
+    fprintf(cmd_out, "File %s not found or not deleted.\n", name);
+    return VFS_NOT_FOUND;
+}
+
+static int version_time(const File *file, int version, time_t *when);
+
+// records every version of a live file as a content event at the time it was made, merged with the deletions
+// and recoveries already recorded; -1 when a cold record cannot be read
+static int event_seed(File *file){
+    int count = file->log_count + file->event_count, n = 0, e = 0;
+    FileEvent *events = malloc(event_cap(count) * sizeof(FileEvent));
+    if(!events){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    for(int v = 1; v <= file->log_count; v++){
+        time_t made;
+        if(version_time(file, v, &made) != 0){
+            free(events);
+            return -1;
+        }
+        uint64_t hash = v <= file->cold_count ? file->cold[v - 1].hash
+                                              : file->log_history[v - 1 - file->cold_count].content->hash;
+        while(e < file->event_count && file->events[e].at < made) events[n++] = file->events[e++];
+        events[n++] = (FileEvent){made, hash, EVENT_CONTENT, 0};
+    }
+    while(e < file->event_count) events[n++] = file->events[e++];
+    if(!is_mapped(file->events)) free(file->events);
+    file->events = events;
+    file->event_count = n;
+    return 0;
+}
+
+// revert file to a specific version
+int revert_file(const char *name, int version){
+    int i = find_file(name);
+    if(i >= 0){
+        File *file = table_file(live, i);
+        if(table_deleted(live, i)){
+            fprintf(cmd_err, "Error: Cannot revert. The file '%s' is currently deleted. Please recover it first.\n", name);
+            return VFS_CONFLICT;
+        }
+        if(version < 1 || version > file->log_count){
+            fprintf(cmd_err, "Version is out of bounds.\n");
+            return VFS_NOT_FOUND;
+        }
+        FilePage *page = live_page(i);
+        file = &page->files[i % PAGE_FILES];
+        // the swap below takes the versions out of time order, from here on the events say what was current when
+        if(!file_timed(file) && event_seed(file) != 0){
+            fprintf(cmd_err, "Error: A version in the cold tier could not be read\n");
+            return VFS_IO;
+        }
+        LogEntry *latest = file_latest(file);
+        if(version > file->cold_count){
+            LogEntry *log = &file->log_history[version - 1 - file->cold_count];
+            LogEntry temp = *latest;
+            *latest = *log;
+            *log = temp;
+        }
+        else{
+            // the cold version comes back into memory and the current one takes its place in the cold tier
+            ColdEntry entry;
+            if(cold_read(file->cold[version - 1].ref, &entry, 1) != 0){
+                fprintf(cmd_err, "Error: Version %d could not be read from the cold tier\n", version);
+                return VFS_IO;
+            }
+            uint64_t ref = cold_write(latest);
+            if(ref == UINT64_MAX){
+                print_errno("Error writing to the cold tier");
+                cold_entry_free(&entry);
+                return VFS_IO;
+            }
+            cold_reserve(file);
+            file->cold[version - 1] = (ColdRef){ref, latest->content->hash};
+            Blob *content = blob_adopt_delta(entry.content, entry.rec.len, latest->content);
+            entry.content = NULL;
+            forget_log(page, latest);
+            latest->content = content;
+            latest->comment = arena_strdup(&page->arena, entry.comment);
+            latest->author_name = arena_strdup(&page->arena, entry.author_name);
+            latest->timestamp = entry.rec.timestamp;
+            latest->version_id = entry.rec.version_id;
+            cold_entry_free(&entry);
+            compact_page(page);
+        }
+        event_push(file, now(), EVENT_CONTENT, file_latest(file)->content->hash);
+        page_sync(page, i % PAGE_FILES);
+
+        journal_append(J_REVERT, version, name, NULL, NULL, NULL, 0);
+        fprintf(cmd_out, "File content successfully reverted to version %d.\n", version);
+        return VFS_OK;
+    }
+    fprintf(cmd_out, "No history found for the file: %s\n", name);   
+    return VFS_NOT_FOUND;
+}
+
+// delete snapshot based on the tag
+int delete_snapshot(const char* tag) {
+    int i = find_snapshot(tag);
+    if(i >= 0){
+        release_snapshot(&snapshots[i]);
+        for(int j = i; j < snapshot_count - 1; j++){
+            snapshots[j] = snapshots[j + 1];
+        }
+        snapshot_count--;
+        index_rebuild(&snapshot_names, snapshot_count, snapshot_key);
+        search_prune();
+        journal_append(J_DELETESNAP, 0, tag, NULL, NULL, NULL, 0);
+        fprintf(cmd_out, "Snapshot with tag '%s' deleted successfully.\n", tag);
+        return VFS_OK;
+    }
+    fprintf(cmd_out, "Snapshot not found for the tag '%s'.\n", tag);
+    return VFS_NOT_FOUND;
+}
+
+// obsoleting snapshot based on the tag for audit purposes
+int obsolete_snapshot(const char* tag){
+    int i = find_snapshot(tag);
+    if(i >= 0){
+        snapshots[i].is_obsolete = 1;
+        journal_append(J_OBSOLETESNAP, 0, tag, NULL, NULL, NULL, 0);
+        fprintf(cmd_out, "Snapshot with tag '%s' deleted successfully.\n", tag);
+        return VFS_OK;
+    }
+    fprintf(cmd_out, "Snapshot not found for the tag '%s'.\n", tag);
+    return VFS_NOT_FOUND;
+}
+
+// lists all the snapshots that have been created
+int list_snapshots(){
+    fprintf(cmd_out, "Available Snapshots:\n");
+    for (int i = 0; i < snapshot_count; i++){
+        char time_str[32];
+        ctime_r(&snapshots[i].timestamp, time_str);
+        time_str[strlen(time_str) - 1] = '\0';
+        fprintf(cmd_out, "Snapshot %d: %s, Timestamp: %s, Status: %s\n", i, snapshots[i].tag, time_str, snapshots[i].is_obsolete ? "Deleted" : "Active");
+    }  
+    return VFS_OK;
+}
+
+// prints one entry of a log history
+static void print_log(const char *author_name, const char *comment, time_t timestamp, int version_id){
+    char time_str[32];
+    fprintf(cmd_out, "Author: %s\n", author_name);
+    fprintf(cmd_out, "Note: %s\n", comment);
+    fprintf(cmd_out, "Timestamp: %s\n", ctime_r(&timestamp, time_str));
+    fprintf(cmd_out, "Version: %d\n", version_id);
+    fprintf(cmd_out, "-----------------------------\n");
+}
+
+// log history for a file, the cold versions are read back from the cold tier
+int log_history(const char *name){
+    int i = find_file(name);
+    File *file = table_file(live, i);
+    if(file){
+        fprintf(cmd_out, "Log History for %s:\n", name);
+        if(table_deleted(live, i)){
+            fprintf(cmd_out, "Note: This file is currently deleted.\n");
+        }
+        for(int j = 0; j < file->cold_count; j++){
+            ColdEntry entry;
+            if(cold_read(file->cold[j].ref, &entry, 0) != 0){
+                fprintf(cmd_err, "Error: Version %d could not be read from the cold tier\n", j + 1);
+                return VFS_IO;
+            }
+            print_log(entry.author_name, entry.comment, entry.rec.timestamp, entry.rec.version_id);
+            cold_entry_free(&entry);
+        }
+        for(int j = 0; j < file->hot_count; j++){
+            const LogEntry *log = &file->log_history[j];
+            print_log(log->author_name, log->comment, log->timestamp, log->version_id);
+        }
+        return VFS_OK;
+    }
+    fprintf(cmd_out, "No history found for the file: %s\n", name);   
+    return VFS_NOT_FOUND;
+}
+
+// the content of a version, numbered as for revert; *blob is set to its blob when the version is in
+// memory and to NULL when it was read from the cold tier, pass both to version_put
+// returns NULL when a cold version cannot be read
+static const char* version_get(const File *file, int version, Blob **blob, size_t *len){
+    if(version > file->cold_count){
+        *blob = file->log_history[version - 1 - file->cold_count].content;
+        *len = (*blob)->len;
+        return blob_get(*blob);
+    }
+    ColdEntry entry;
+    *blob = NULL;
+    if(cold_read(file->cold[version - 1].ref, &entry, 1) != 0) return NULL;
+    *len = entry.rec.len;
+    free(entry.comment);
+    return entry.content;
+}
+
+// releases content returned by version_get
+static void version_put(Blob *blob, const char *content){
+    if(blob) blob_put(blob, content);
+    else free((char *)content);
+}
+
+// the time a version of a file was made, numbered as for revert; a cold version's comes from its record header
+static int version_time(const File *file, int version, time_t *when){
+    if(version > file->cold_count){
+        *when = file->log_history[version - 1 - file->cold_count].timestamp;
+        return 0;
+    }
+    ColdRecord rec;
+    if(cold_fetch(file->cold[version - 1].ref, &rec, sizeof(rec)) != 0) return -1;
+    *when = rec.timestamp;
+    return 0;
+}
+
+// the id log shows for a version of a file, numbered as for revert; -1 when its cold record cannot be read
+static int version_log_id(const File *file, int version){
+    if(version > file->cold_count) return file->log_history[version - 1 - file->cold_count].version_id;
+    ColdRecord rec;
+    return cold_fetch(file->cold[version - 1].ref, &rec, sizeof(rec)) == 0 ? rec.version_id : -1;
+}
+
+// the last event of a file at or before a time among the kinds in mask (a bit per kind), -1 when there is none;
+// events are kept in time order, so this is a binary search
+static int event_at(const File *file, time_t when, int mask){
+    int low = -1, high = file->event_count - 1;
+    while(low < high){
+        int mid = high - (high - low) / 2;
+        if(file->events[mid].at <= when) low = mid;
+        else high = mid - 1;
+    }
+    while(low >= 0 && !(mask >> file->events[low].kind & 1)) low--;
+    return low;
+}
+
+// the version of a file current at a time, 0 when the file is younger or that version is gone, -1 when a cold
+// record cannot be read. Until a revert, versions are appended in time order and this is a binary search: a
+// time within the hot versions never reads the cold tier, an older one reads at most log2(versions) record
+// headers. A reverted file's content events name the content current then instead; its newest version is
+// returned
+static int version_at(const File *file, time_t when){
+    if(file_timed(file)){
+        int e = event_at(file, when, 1 << EVENT_CONTENT);
+        return e >= 0 ? version_holding(file, file->events[e].hash) : 0;
+    }
+    int low = 0, high = file->log_count;
+    if(file->hot_count && file->log_history[0].timestamp <= when) low = file->cold_count + 1;
+    else high = file->cold_count;
+    while(low < high){
+        int mid = high - (high - low) / 2;
+        time_t made;
+        if(version_time(file, mid, &made) != 0) return -1;
+        if(made <= when) low = mid;
+        else high = mid - 1;
+    }
+    return low;
+}
+
+// parses the time of an as-of read, after its '@': seconds since the epoch, a local YYYY-MM-DD[THH:MM[:SS]],
+// HH:MM[:SS] today or -<n><s|m|h|d> for that long ago; returns -1 when it is none of these
+static int parse_time(const char *text, time_t *when){
+    char *end;
+    if(text[0] == '-'){
+        long n = strtol(text + 1, &end, 10);
+        long unit = *end == 's' ? 1 : *end == 'm' ? 60 : *end == 'h' ? 3600 : *end == 'd' ? 86400 : 0;
+        if(end == text + 1 || n < 0 || !unit || end[1]) return -1;
+        *when = time(NULL) - n * unit;
+        return 0;
+    }
+    long long seconds = strtoll(text, &end, 10);
+    if(end != text && !*end){
+        *when = (time_t)seconds;
+        return 0;
+    }
+    struct tm tm;
+    time_t today = time(NULL);
+    localtime_r(&today, &tm);
+    tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+    const char *formats[] = {"%Y-%m-%dT%H:%M:%S", "%Y-%m-%dT%H:%M", "%Y-%m-%d", "%H:%M:%S", "%H:%M"};
+    for(int f = 0; f < 5; f++){
+        struct tm parsed = tm;
+        end = strptime(text, formats[f], &parsed);
+        if(end && !*end){
+            parsed.tm_isdst = -1;
+            *when = mktime(&parsed);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// the table whose histories show a time: the live tree's from the last rollback on, before it the tree that
+// rollback replaced, and so on back; a tree's histories hold every change made to it up to its rollback
+static const FileTable* table_at(time_t when){
+    const FileTable *table = live;
+    for(int r = rollback_count - 1; r >= 0 && when < rollbacks[r].at; r--){
+        table = rollbacks[r].table;
+    }
+    return table;
+}
+
+// whether a file had been deleted by a time: its last deletion or recovery at or before then was a deletion
+static int deleted_by(const File *file, time_t when){
+    int e = event_at(file, when, 1 << EVENT_DELETE | 1 << EVENT_RECOVER);
+    return e >= 0 && file->events[e].kind == EVENT_DELETE;
+}
+
+// prints the content a file had at a time, read from its history without touching the live tree
+int view_at(const char *filename, const char *time_text){
+    time_t when;
+    if(parse_time(time_text, &when) != 0){
+        fprintf(cmd_err, "Error: Invalid time '%s'\n", time_text);
+        return VFS_INVALID;
+    }
+    const File *file = table_file(table_at(when), find_file(filename));
+    int version = file ? version_at(file, when) : 0;
+    if(version == 0){
+        fprintf(cmd_out, "File %s did not exist at that time.\n", filename);
+        return VFS_NOT_FOUND;
+    }
+    if(version > 0 && deleted_by(file, when)){
+        fprintf(cmd_err, "Error: File '%s' was deleted at that time.\n", filename);
+        return VFS_CONFLICT;
+    }
+    Blob *blob;
+    size_t len;
+    const char *content = version > 0 ? version_get(file, version, &blob, &len) : NULL;
+    if(!content){
+        fprintf(cmd_err, "Error: A version in the cold tier could not be read\n");
+        return VFS_IO;
+    }
+    fwrite(content, 1, len, cmd_out);
+    fprintf(cmd_out, "\n\n");
+    version_put(blob, content);
+    return VFS_OK;
+}
+
+// prints the files present at a time, those with a version then and not deleted by then, with the id log
+// shows for that version
+int view_fileSystem_at(const char *time_text){
+    time_t when;
+    if(parse_time(time_text, &when) != 0){
+        fprintf(cmd_err, "Error: Invalid time '%s'\n", time_text);
+        return VFS_INVALID;
+    }
+    const FileTable *table = table_at(when);
+    for(int p = 0; table && p < table->page_count; p++){
+        const FilePage *page = table->pages[p];
+        for(uint64_t used = page ? page->used : 0; used; used &= used - 1){
+            int k = __builtin_ctzll(used), id = p * PAGE_FILES + k;
+            const File *file = &page->files[k];
+            int version = version_at(file, when);
+            if(version == 0 || (version > 0 && deleted_by(file, when))) continue;
+            int shown = version > 0 ? version_log_id(file, version) : -1;
+            if(shown < 0){
+                fprintf(cmd_err, "Error: A version in the cold tier could not be read\n");
+                return VFS_IO;
+            }
+            fprintf(cmd_out, "File name:     %s (version %d)\n", file_names[id], shown);
+        }
+    }
+    return VFS_OK;
+}
+
+// writes a unified diff between two versions of a file, numbered as for revert
+int diff_versions(const char *name, int v1, int v2){
+    File *file = table_file(live, find_file(name));
+    if(!file){
+        fprintf(cmd_out, "No history found for the file: %s\n", name);
+        return VFS_NOT_FOUND;
+    }
+    if(v1 < 1 || v1 > file->log_count || v2 < 1 || v2 > file->log_count){
+        fprintf(cmd_err, "Version is out of bounds.\n");
+        return VFS_NOT_FOUND;
+    }
+    fprintf(cmd_out, "--- %s version %d\n+++ %s version %d\n", name, v1, name, v2);
+    int hot = file->cold_count + 1;
+    if(v1 >= hot && v2 >= hot && file->log_history[v1 - hot].content == file->log_history[v2 - hot].content) return VFS_OK;
+
+    Blob *old_blob, *new_blob;
+    size_t old_len, new_len;
+    const char *old_text = version_get(file, v1, &old_blob, &old_len);
+    const char *new_text = version_get(file, v2, &new_blob, &new_len);
+    if(!old_text || !new_text){
+        fprintf(cmd_err, "Error: Version %d could not be read from the cold tier\n", old_text ? v2 : v1);
+        if(old_text) version_put(old_blob, old_text);
+        if(new_text) version_put(new_blob, new_text);
+        return VFS_IO;
+    }
+    DiffSide a, b;
+    diff_side(&a, old_text, old_len);
+    diff_side(&b, new_text, new_len);
+    diff_run(&a, &b);
+    diff_print(&a, &b);
+    diff_side_free(&a);
+    diff_side_free(&b);
+    version_put(old_blob, old_text);
+    version_put(new_blob, new_text);
+    return VFS_OK;
+}
+
+static __thread const FileTable *diff_table;    // table diffsnap looks names up in
+
+// whether a file id is present and not deleted in diff_table
+static int in_diff_table(int id){
+    return table_present(diff_table, id);
+}
+
+// id of the file with the name of file id in a table, or -1 when absent or deleted
+// ids never change their name, so the same id is tried before the other ids of the name
+static int diff_find(const FileTable *table, int id){
+    if(table_present(table, id)) return id;
+    diff_table = table;
+    return index_find(&file_index, file_names[id], file_key, in_diff_table);
+}
+
+// current content of a file id a table holds
+static Blob* table_latest(const FileTable *table, int id){
+    return table->pages[id / PAGE_FILES]->latest[id % PAGE_FILES];
+}
+
+// lists the files added, removed and modified from one snapshot to another
+// pages the two snapshots share are skipped whole and the store is content-addressed,
+// so only files whose latest blob differs have their lines compared
+int diff_snapshots(int from, int to){
+    if(from < 0 || from >= snapshot_count || to < 0 || to >= snapshot_count){
+        fprintf(cmd_err, "Error: Invalid snapshot index\n");
+        return VFS_NOT_FOUND;
+    }
+    const FileTable *ta = snapshots[from].table, *tb = snapshots[to].table;
+    int slots = table_slots(ta) > table_slots(tb) ? table_slots(ta) : table_slots(tb);
+    int changes = 0;
+    for(int id = 0; id < slots; id++){
+        if(id % PAGE_FILES == 0 && id < table_slots(ta) && id < table_slots(tb)
+           && ta->pages[id / PAGE_FILES] == tb->pages[id / PAGE_FILES]){
+            id += PAGE_FILES - 1;
+            continue;
+        }
+        if(table_present(ta, id)){
+            int other = diff_find(tb, id);
+            if(other < 0){
+                fprintf(cmd_out, "Removed:  %s\n", file_names[id]);
+                changes++;
+                continue;
+            }
+            Blob *ba = table_latest(ta, id), *bb = table_latest(tb, other);
+            if(ba == bb) continue;
+            const char *old_text = blob_get(ba), *new_text = blob_get(bb);
+            DiffSide a, b;
+            diff_side(&a, old_text, ba->len);
+            diff_side(&b, new_text, bb->len);
+            diff_run(&a, &b);
+            long removed = 0, added = 0;
+            for(long k = 0; k < a.count; k++) removed += a.changed[k];
+            for(long k = 0; k < b.count; k++) added += b.changed[k];
+            fprintf(cmd_out, "Modified: %s (+%ld -%ld lines)\n", file_names[id], added, removed);
+            changes++;
+            diff_side_free(&a);
+            diff_side_free(&b);
+            blob_put(ba, old_text);
+            blob_put(bb, new_text);
+        }
+        if(table_present(tb, id) && diff_find(ta, id) < 0){
+            fprintf(cmd_out, "Added:    %s\n", file_names[id]);
+            changes++;
+        }
+    }
+    if(!changes) fprintf(cmd_out, "No differences between snapshot %d and snapshot %d.\n", from, to);
+    return VFS_OK;
+}
+
+// what a checkout job works on: its entries, the table they come from and the target directory
+typedef struct{
+    CheckoutEntry *entries;
+    const FileTable *table;
+    int dir_fd;                                // the target directory, names are opened relative to it
+    int incremental;
+}CheckoutJob;
+
+// whether a file name stays below the directory it is checked out to: relative, without empty, . or .. parts
+static int checkout_name_ok(const char *name){
+    for(const char *part = name;; part++){
+        size_t len = strcspn(part, "/");
+        if(len == 0 || (part[0] == '.' && (len == 1 || (len == 2 && part[1] == '.')))) return 0;
+        part += len;
+        if(!*part) return 1;
+    }
+}
+
+// opens a checked name below the target directory one part at a time without following symbolic links, so
+// a link already in the target cannot lead a write outside it; with create set, missing directories are
+// made and the file is created or truncated for writing, otherwise it is opened for reading
+static int checkout_open(int dir_fd, const char *name, int create){
+    char part[NAME_MAX + 1];
+    int fd = dir_fd;
+    const char *p = name;
+    for(const char *slash; (slash = strchr(p, '/')); p = slash + 1){
+        if(slash - p > NAME_MAX){
+            errno = ENAMETOOLONG;
+            break;
+        }
+        snprintf(part, sizeof(part), "%.*s", (int)(slash - p), p);
+        int next = openat(fd, part, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+        if(next == -1 && errno == ENOENT && create && (mkdirat(fd, part, 0755) == 0 || errno == EEXIST)){
+            next = openat(fd, part, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+        }
+        if(fd != dir_fd) close(fd);
+        fd = next;
+        if(fd == -1) return -1;
+    }
+    int file = -1;
+    if(!strchr(p, '/')) file = openat(fd, p, create ? O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW : O_RDONLY | O_NOFOLLOW, 0644);
+    int saved = errno;
+    if(fd != dir_fd) close(fd);
+    errno = saved;
+    if(file != -1) io_count(IO_OPEN, 0);
+    return file;
+}
+
+// whether the target file of a name holds exactly the content of a blob: sizes are compared first, then the
+// content hash, so a differing file is usually told apart without reading it
+static int checkout_same(int dir_fd, const char *name, const Blob *b){
+    int fd = checkout_open(dir_fd, name, 0);
+    if(fd == -1) return 0;
+    struct stat st;
+    int same = 0;
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && (size_t)st.st_size == b->len){
+        size_t len;
+        char *text = read_source(fd, &len);
+        same = text && len == b->len && hash_bytes(text, len) == b->hash;
+        free(text);
+    }
+    close(fd);
+    return same;
+}
+
+// pool job writing entries begin..end-1 of a checkout, each file with one write of its whole content
+static void checkout_write(void *ctx, int begin, int end){
+    CheckoutJob *job = ctx;
+    for(int k = begin; k < end; k++){
+        CheckoutEntry *e = &job->entries[k];
+        const char *name = file_names[e->id];
+        if(!checkout_name_ok(name)){
+            e->error = -1;
+            continue;
+        }
+        Blob *b = table_latest(job->table, e->id);
+        if(job->incremental && checkout_same(job->dir_fd, name, b)){
+            e->unchanged = 1;
+            continue;
+        }
+        int fd = checkout_open(job->dir_fd, name, 1);
+        if(fd == -1){
+            e->error = errno;
+            continue;
+        }
+        // read through the content cache without filling it, a checkout reads every file once
+        const char *content = blob_build(b, 0);
+        for(size_t done = 0; done < b->len;){
+            ssize_t n = io_write(fd, content + done, b->len - done);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0){
+                e->error = n < 0 ? errno : EIO;
+                break;
+            }
+            done += n;
+        }
+        blob_put(b, content);
+        if(close(fd) != 0 && !e->error) e->error = errno;
+    }
+}
+
+// writes every file present in a snapshot below a directory, creating the directories its names need and
+// never following a symbolic link found below it; with incremental set, files that already hold their
+// content are left alone. Files the snapshot does not hold are never removed. Workers on the pool write
+// the files, each with a single write
+int checkout_snapshot(int snapshot_index, const char *dir, int incremental){
+    if(snapshot_index < 0 || snapshot_index >= snapshot_count){
+        fprintf(cmd_err, "Error: Invalid snapshot index\n");
+        return VFS_NOT_FOUND;
+    }
+    if(snapshots[snapshot_index].is_obsolete){
+        fprintf(cmd_err, "Error: Referred snapshot index %d is obsolete\n", snapshot_index);
+        return VFS_CONFLICT;
+    }
+    if(mkdir(dir, 0755) != 0 && errno != EEXIST){
+        print_errno("Error creating directory");
+        return VFS_IO;
+    }
+    int dir_fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if(dir_fd == -1){
+        print_errno("Error opening directory");
+        return VFS_IO;
+    }
+    io_count(IO_OPEN, 0);
+    uint64_t start = clock_ns();
+    const FileTable *table = snapshots[snapshot_index].table;
+    int count = 0;
+    for(int p = 0; p < table->page_count; p++){
+        const FilePage *page = table->pages[p];
+        if(page) count += __builtin_popcountll(page->used & ~page->deleted);
+    }
+    CheckoutEntry *entries = calloc(count ? count : 1, sizeof(CheckoutEntry));
+    if(!entries){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    int n = 0;
+    uint64_t bytes = 0;
+    for(int p = 0; p < table->page_count; p++){
+        const FilePage *page = table->pages[p];
+        for(uint64_t shown = page ? page->used & ~page->deleted : 0; shown; shown &= shown - 1){
+            int slot = __builtin_ctzll(shown);
+            entries[n++].id = p * PAGE_FILES + slot;
+            bytes += page->latest[slot]->len;
+        }
+    }
+    CheckoutJob job = {entries, table, dir_fd, incremental};
+    parallel_for(count, checkout_write, &job);
+    close(dir_fd);
+    long written = 0, unchanged = 0, failed = 0;
+    for(int k = 0; k < count; k++){
+        const CheckoutEntry *e = &entries[k];
+        if(e->error == -1){
+            fprintf(cmd_err, "Error: %s is not a relative path below %s\n", file_names[e->id], dir);
+            failed++;
+        }
+        else if(e->error){
+            fprintf(cmd_err, "Error: %s/%s could not be written: %s\n", dir, file_names[e->id], strerror(e->error));
+            failed++;
+        }
+        else if(e->unchanged) unchanged++;
+        else written++;
+    }
+    free(entries);
+    double seconds = (clock_ns() - start) / 1e9;
+    fprintf(cmd_out, "Checked out snapshot %d to %s: %ld written, %ld unchanged, %ld failed (%.1f MB in %.3f s, %.0f files/s, %.1f MB/s)\n",
+            snapshot_index, dir, written, unchanged, failed, bytes / 1e6, seconds, seconds > 0 ? count / seconds : 0.0,
+            seconds > 0 ? bytes / 1e6 / seconds : 0.0);
+    return failed ? VFS_IO : VFS_OK;
+}
+
+// lists the versions holding a pattern: the current version of every file, or every version with all_versions,
+// of the live tree or of the snapshot at index snapshot
+// only the contents the search index finds every trigram of the pattern in are read, each one once
+int search_content(const char *pattern, int all_versions, const char *snapshot){
+    int index = snapshot ? atoi(snapshot) : -1;
+    if(snapshot && (index < 0 || index >= snapshot_count)){
+        fprintf(cmd_err, "Error: Invalid snapshot index\n");
+        return VFS_NOT_FOUND;
+    }
+    // under the shared lock the index cannot be built, the daemon only shares grep once it is
+    if(!__atomic_load_n(&search_ready, __ATOMIC_ACQUIRE) && !shared_reader) search_build();
+    size_t len = strlen(pattern);
+    long candidates = -1;
+    DocRun *runs = search_ready ? search_candidates(pattern, len, &candidates) : NULL;
+    // per document: 0 when it lacks a trigram of the pattern, 1 until it is read, then 2 when it holds the pattern, 3 when not
+    unsigned char *found = candidates >= 0 ? calloc(search_doc_count + 1, 1) : NULL;
+    if(candidates >= 0 && !found){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    for(long c = 0; c < candidates; c++){
+        memset(found + runs[c].first, 1, runs[c].count);
+    }
+    free(runs);
+    const FileTable *table = index >= 0 ? snapshots[index].table : live;
+    long matches = 0;
+    for(int p = 0; table && p < table->page_count; p++){
+        const FilePage *page = table->pages[p];
+        for(uint64_t shown = page ? page->used & ~page->deleted : 0; shown; shown &= shown - 1){
+            int k = __builtin_ctzll(shown);
+            const File *file = &page->files[k];
+            for(int v = all_versions ? 1 : file->log_count; v >= 1 && v <= file->log_count; v++){
+                uint64_t hash = v <= file->cold_count ? file->cold[v - 1].hash
+                                                      : file->log_history[v - 1 - file->cold_count].content->hash;
+                int doc = found ? search_find(hash) : -1;
+                int holds = doc >= 0 ? found[doc] == 2 : 0;
+                if(doc < 0 || found[doc] == 1){
+                    Blob *blob;
+                    size_t n;
+                    const char *content = version_get(file, v, &blob, &n);
+                    if(!content){
+                        fprintf(cmd_err, "Error: Version %d of %s could not be read from the cold tier\n", v, file_names[p * PAGE_FILES + k]);
+                        continue;
+                    }
+                    holds = text_contains(content, n, pattern, len);
+                    version_put(blob, content);
+                    if(doc >= 0) found[doc] = holds ? 2 : 3;
+                }
+                if(!holds) continue;
+                fprintf(cmd_out, "%s: version %d\n", file_names[p * PAGE_FILES + k], v);
+                matches++;
+            }
+        }
+    }
+    free(found);
+    if(!matches) fprintf(cmd_out, "No version holds '%s'.\n", pattern);
+    return VFS_OK;
+}
+
+// adds a page's slots, strings and grown version arrays to a memory statistic
+static void mem_page(MemStat *stat, const FilePage *page){
+    stat->bytes += sizeof(FilePage) + page->arena.bytes;
+    for(uint64_t used = page->used; used; used &= used - 1){
+        const File *file = &page->files[__builtin_ctzll(used)];
+        if(stat->unit[0] == 'f') stat->count++;
+        if(file->log_history != &file->first_log) stat->bytes += file->hot_cap * sizeof(LogEntry);
+        if(file->cold && !is_mapped(file->cold)) stat->bytes += file->cold_cap * sizeof(ColdRef);
+        if(file->events && !is_mapped(file->events)) stat->bytes += event_cap(file->event_count) * sizeof(FileEvent);
+    }
+}
+
+// walks the state and fills in what the live tree, the snapshots, the content history and the file
+// names hold; pages and tables shared with the live tree count there, shared by snapshots count once
+static void stats_memory(MemStat *mem, uint64_t *content_bytes, uint64_t *stored_bytes){
+    mem[MEM_LIVE] = (MemStat){"live_tree", "files", 0, 0};
+    mem[MEM_SNAPSHOTS] = (MemStat){"snapshots", "snapshots", snapshot_count, snapshot_count * sizeof(Snapshot)};
+    mem[MEM_HISTORY] = (MemStat){"history", "blobs", 0, blob_buckets * sizeof(Blob *)};
+    mem[MEM_NAMES] = (MemStat){"names", "names", name_count,
+                               name_arena.bytes + name_cap * sizeof(char *) + file_index.cap * sizeof(IndexSlot)};
+    mem[MEM_SEARCH] = (MemStat){"search_index", "contents", search_doc_count,
+                                search_cap * sizeof(Posting) + search_doc_cap * sizeof(uint64_t)
+                                + search_index.cap * sizeof(IndexSlot) + (search_seen ? (1 << 24) / 8 : 0)};
+    for(size_t i = 0; i < search_cap; i++){
+        mem[MEM_SEARCH].bytes += search_postings[i].cap * sizeof(DocRun);
+    }
+    pthread_mutex_lock(&cache_lock);
+    mem[MEM_CACHE] = (MemStat){"content_cache", "contents", cache_count, cache_bytes};
+    pthread_mutex_unlock(&cache_lock);
+
+    size_t live_pages = 0;
+    if(live){
+        mem[MEM_LIVE].bytes += sizeof(FileTable) + live->page_count * sizeof(FilePage *);
+        for(int p = 0; p < live->page_count; p++){
+            if(live->pages[p]) mem_page(&mem[MEM_LIVE], live->pages[p]);
+        }
+    }
+
+    // the trees rollbacks replaced are counted with the snapshots
+    size_t total = live ? live->page_count : 0, tables = 0;
+    mem[MEM_SNAPSHOTS].bytes += rollback_count * sizeof(Rollback);
+    for(int i = 0; i < snapshot_count + rollback_count; i++){
+        if(kept_table(i)) total += kept_table(i)->page_count;
+        if(i < snapshot_count && !is_mapped(snapshots[i].tag)) mem[MEM_SNAPSHOTS].bytes += strlen(snapshots[i].tag) + 1;
+    }
+    FilePage **pages = malloc((total + 1) * sizeof(FilePage *));
+    FileTable **seen = malloc((snapshot_count + rollback_count + 1) * sizeof(FileTable *));
+    if(!pages || !seen){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    for(int p = 0; live && p < live->page_count; p++){
+        if(live->pages[p]) pages[live_pages++] = live->pages[p];
+    }
+    qsort(pages, live_pages, sizeof(FilePage *), compare_pointer);
+    size_t count = live_pages;
+    for(int i = 0; i < snapshot_count + rollback_count; i++){
+        FileTable *table = kept_table(i);
+        if(table && table != live) seen[tables++] = table;
+        for(int p = 0; table && p < table->page_count; p++){
+            FilePage *page = table->pages[p];
+            if(page && !bsearch(&page, pages, live_pages, sizeof(FilePage *), compare_pointer)) pages[count++] = page;
+        }
+    }
+    qsort(seen, tables, sizeof(FileTable *), compare_pointer);
+    for(size_t i = 0; i < tables; i++){
+        if(i == 0 || seen[i] != seen[i - 1]) mem[MEM_SNAPSHOTS].bytes += sizeof(FileTable) + seen[i]->page_count * sizeof(FilePage *);
+    }
+    qsort(pages + live_pages, count - live_pages, sizeof(FilePage *), compare_pointer);
+    for(size_t i = live_pages; i < count; i++){
+        if(i == live_pages || pages[i] != pages[i - 1]) mem_page(&mem[MEM_SNAPSHOTS], pages[i]);
+    }
+    free(pages);
+    free(seen);
+
+    for(size_t i = 0; i < blob_buckets; i++){
+        for(const Blob *b = blob_table[i]; b; b = b->next){
+            mem[MEM_HISTORY].count++;
+            mem[MEM_HISTORY].bytes += sizeof(Blob) + b->chunk_count * sizeof(Blob *);
+            if(b->data && !is_mapped(b->data)) mem[MEM_HISTORY].bytes += b->stored + 1;
+        }
+    }
+    *content_bytes = blob_bytes;
+    *stored_bytes = blob_stored;
+}
+
+// writes a nanosecond count as microseconds
+static void print_us(const char *format, uint64_t ns){
+    fprintf(cmd_out, format, ns / 1000.0);
+}
+
+// shows command latencies, memory per part of the state and file I/O;
+// format is NULL for a table, "json" or "prom" (Prometheus text exposition) for machines
+int show_stats(const char *format){
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    int commands = sizeof(command_stats) / sizeof(command_stats[0]);
+    MemStat mem[MEM_KINDS];
+    uint64_t content_bytes, stored_bytes;
+    stats_memory(mem, &content_bytes, &stored_bytes);
+    pthread_mutex_lock(&cache_lock);
+    uint64_t hits = cache_hits, misses = cache_misses;
+    pthread_mutex_unlock(&cache_lock);
+
+    if(!format){
+        fprintf(cmd_out, "%-13s %10s %11s %11s %11s %11s %11s\n", "Command", "Calls", "p50 us", "p90 us", "p99 us", "max us", "mean us");
+        for(int i = 0; i < commands; i++){
+            const CommandStat *stat = &command_stats[i];
+            uint64_t count = __atomic_load_n(&stat->count, __ATOMIC_RELAXED);
+            if(!count) continue;
+            fprintf(cmd_out, "%-13s %10llu", stat->name, (unsigned long long)count);
+            for(int q = 0; q < 3; q++) print_us(" %11.1f", stats_percentile(stat, quantiles[q]));
+            print_us(" %11.1f", __atomic_load_n(&stat->max_ns, __ATOMIC_RELAXED));
+            print_us(" %11.1f\n", __atomic_load_n(&stat->total_ns, __ATOMIC_RELAXED) / count);
+        }
+        fprintf(cmd_out, "\n%-13s %10s %-10s %14s\n", "Memory", "Count", "", "Bytes");
+        for(int m = 0; m < MEM_KINDS; m++){
+            fprintf(cmd_out, "%-13s %10llu %-10s %14llu\n", mem[m].name, (unsigned long long)mem[m].count, mem[m].unit, (unsigned long long)mem[m].bytes);
+        }
+        fprintf(cmd_out, "%-13s %10s %-10s %14zu\n", "state_map", "", "", state_map_len);
+        fprintf(cmd_out, "%-13s %10s %-10s %14llu\n", "cold_spill", "", "", (unsigned long long)cold_spilled);
+        fprintf(cmd_out, "Content: %llu bytes in versions, %llu bytes stored\n", (unsigned long long)content_bytes, (unsigned long long)stored_bytes);
+        fprintf(cmd_out, "Cache: %llu hits, %llu misses, budget %zu bytes\n", (unsigned long long)hits, (unsigned long long)misses, cache_budget);
+        fprintf(cmd_out, "\n%-13s %10s %14s\n", "I/O", "Calls", "Bytes");
+        for(int k = 0; k < IO_KINDS; k++){
+            fprintf(cmd_out, "%-13s %10llu %14llu\n", io_names[k], (unsigned long long)__atomic_load_n(&io_stats[k].calls, __ATOMIC_RELAXED),
+                    (unsigned long long)__atomic_load_n(&io_stats[k].bytes, __ATOMIC_RELAXED));
+        }
+        return VFS_OK;
+    }
+    if(strcmp(format, "json") == 0){
+        fprintf(cmd_out, "{\"commands\": {");
+        int first = 1;
+        for(int i = 0; i < commands; i++){
+            const CommandStat *stat = &command_stats[i];
+            uint64_t count = __atomic_load_n(&stat->count, __ATOMIC_RELAXED);
+            if(!count) continue;
+            fprintf(cmd_out, "%s\"%s\": {\"count\": %llu", first ? "" : ", ", stat->name, (unsigned long long)count);
+            print_us(", \"p50_us\": %.3f", stats_percentile(stat, 0.5));
+            print_us(", \"p90_us\": %.3f", stats_percentile(stat, 0.9));
+            print_us(", \"p99_us\": %.3f", stats_percentile(stat, 0.99));
+            print_us(", \"p999_us\": %.3f", stats_percentile(stat, 0.999));
+            print_us(", \"max_us\": %.3f", __atomic_load_n(&stat->max_ns, __ATOMIC_RELAXED));
+            print_us(", \"total_us\": %.3f}", __atomic_load_n(&stat->total_ns, __ATOMIC_RELAXED));
+            first = 0;
+        }
+        fprintf(cmd_out, "}, \"memory\": {");
+        for(int m = 0; m < MEM_KINDS; m++){
+            fprintf(cmd_out, "%s\"%s\": {\"%s\": %llu, \"bytes\": %llu}", m ? ", " : "", mem[m].name, mem[m].unit,
+                    (unsigned long long)mem[m].count, (unsigned long long)mem[m].bytes);
+        }
+        fprintf(cmd_out, ", \"state_map_bytes\": %zu, \"cold_spill_bytes\": %llu, \"content_bytes\": %llu, \"stored_bytes\": %llu}, \"io\": {",
+                state_map_len, (unsigned long long)cold_spilled, (unsigned long long)content_bytes, (unsigned long long)stored_bytes);
+        for(int k = 0; k < IO_KINDS; k++){
+            fprintf(cmd_out, "%s\"%s\": {\"calls\": %llu, \"bytes\": %llu}", k ? ", " : "", io_names[k],
+                    (unsigned long long)__atomic_load_n(&io_stats[k].calls, __ATOMIC_RELAXED),
+                    (unsigned long long)__atomic_load_n(&io_stats[k].bytes, __ATOMIC_RELAXED));
+        }
+        fprintf(cmd_out, "}, \"cache\": {\"hits\": %llu, \"misses\": %llu, \"budget_bytes\": %zu}}\n",
+                (unsigned long long)hits, (unsigned long long)misses, cache_budget);
+        return VFS_OK;
+    }
+    if(strcmp(format, "prom") == 0){
+        fprintf(cmd_out, "# TYPE vfs_command_latency_seconds summary\n");
+        for(int i = 0; i < commands; i++){
+            const CommandStat *stat = &command_stats[i];
+            uint64_t count = __atomic_load_n(&stat->count, __ATOMIC_RELAXED);
+            if(!count) continue;
+            for(int q = 0; q < 4; q++){
+                fprintf(cmd_out, "vfs_command_latency_seconds{command=\"%s\",quantile=\"%g\"} %.9f\n", stat->name, quantiles[q],
+                        stats_percentile(stat, quantiles[q]) / 1e9);
+            }
+            fprintf(cmd_out, "vfs_command_latency_seconds_sum{command=\"%s\"} %.9f\n", stat->name,
+                    __atomic_load_n(&stat->total_ns, __ATOMIC_RELAXED) / 1e9);
+            fprintf(cmd_out, "vfs_command_latency_seconds_count{command=\"%s\"} %llu\n", stat->name, (unsigned long long)count);
+        }
+        fprintf(cmd_out, "# TYPE vfs_memory_bytes gauge\n");
+        for(int m = 0; m < MEM_KINDS; m++){
+            fprintf(cmd_out, "vfs_memory_bytes{part=\"%s\"} %llu\n", mem[m].name, (unsigned long long)mem[m].bytes);
+        }
+        fprintf(cmd_out, "vfs_memory_bytes{part=\"state_map\"} %zu\n", state_map_len);
+        fprintf(cmd_out, "vfs_memory_bytes{part=\"cold_spill\"} %llu\n", (unsigned long long)cold_spilled);
+        fprintf(cmd_out, "# TYPE vfs_memory_objects gauge\n");
+        for(int m = 0; m < MEM_KINDS; m++){
+            fprintf(cmd_out, "vfs_memory_objects{part=\"%s\",kind=\"%s\"} %llu\n", mem[m].name, mem[m].unit, (unsigned long long)mem[m].count);
+        }
+        fprintf(cmd_out, "# TYPE vfs_content_bytes gauge\nvfs_content_bytes{form=\"versions\"} %llu\nvfs_content_bytes{form=\"stored\"} %llu\n",
+                (unsigned long long)content_bytes, (unsigned long long)stored_bytes);
+        fprintf(cmd_out, "# TYPE vfs_io_calls_total counter\n");
+        for(int k = 0; k < IO_KINDS; k++){
+            fprintf(cmd_out, "vfs_io_calls_total{op=\"%s\"} %llu\n", io_names[k], (unsigned long long)__atomic_load_n(&io_stats[k].calls, __ATOMIC_RELAXED));
+        }
+        fprintf(cmd_out, "# TYPE vfs_io_bytes_total counter\n");
+        for(int k = 0; k < IO_KINDS; k++){
+            fprintf(cmd_out, "vfs_io_bytes_total{op=\"%s\"} %llu\n", io_names[k], (unsigned long long)__atomic_load_n(&io_stats[k].bytes, __ATOMIC_RELAXED));
+        }
+        fprintf(cmd_out, "# TYPE vfs_cache_lookups_total counter\nvfs_cache_lookups_total{result=\"hit\"} %llu\nvfs_cache_lookups_total{result=\"miss\"} %llu\n",
+                (unsigned long long)hits, (unsigned long long)misses);
+        return VFS_OK;
+    }
+    if(strcmp(format, "reset") == 0){
+        for(int i = 0; i < commands; i++){
+            const char *name = command_stats[i].name;
+            memset(&command_stats[i], 0, sizeof(CommandStat));
+            command_stats[i].name = name;
+        }
+        memset(io_stats, 0, sizeof(io_stats));
+        pthread_mutex_lock(&cache_lock);
+        cache_hits = cache_misses = 0;
+        pthread_mutex_unlock(&cache_lock);
+        fprintf(cmd_out, "Statistics reset.\n");
+        return VFS_OK;
+    }
+    fprintf(cmd_err, "Error: Stats format must be json, prom or reset\n");
+    return VFS_INVALID;
+}
+
+// frees up the memory
+void cleanup(){
+    bgsave_reap(1);
+    free_state();
+    free(blob_table);
+    free(file_index.slots);
+    free(snapshot_names.slots);
+    free(search_seen);
+    if(state_map) munmap(state_map, state_map_len);
+    if(cold_fd >= 0) close(cold_fd);
+    free(journal.data);
+    free(journal_base);
+    free(pool_dead.data);
+    pool_stop();
+}
+
+// reads a length-prefixed field of a journal record into a NUL terminated string
+static char* journal_field(const char **p, const char *end, size_t width){
+    uint64_t len = 0;
+    if(end - *p < (long)width) return NULL;
+    memcpy(&len, *p, width);
+    *p += width;
+    if((uint64_t)(end - *p) < len) return NULL;
+    char *str = malloc(len + 1);
+    if(!str){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(str, *p, len);
+    str[len] = '\0';
+    *p += len;
+    return str;
+}
+
+// applies the journal of a state file on top of the just loaded base image
+// returns the number of records applied, or -1 when there is no journal for this base
+static long replay_journal(const char *filename, uint64_t generation){
+    char jname[4096];
+    journal_name(jname, sizeof(jname), filename);
+    int fd = io_open(jname, O_RDONLY, 0);
+    if(fd == -1) return -1;
+    struct stat st;
+    char *map = NULL;
+    if(fstat(fd, &st) == 0 && st.st_size >= 12){
+        map = io_map(fd, st.st_size);
+    }
+    close(fd);
+    if(!map || map == MAP_FAILED) return -1;
+    uint64_t journal_generation;
+    memcpy(&journal_generation, map + 4, sizeof(journal_generation));
+    if(memcmp(map, JOURNAL_MAGIC, 4) != 0 || journal_generation != generation){
+        fprintf(cmd_err, "Warning: ignoring journal %s, it does not belong to this state\n", jname);
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    FILE *saved_out = cmd_out;
+    cmd_out = fopen("/dev/null", "w");
+    replaying = 1;
+    long applied = 0;
+    const char *p = map + 12, *end = map + st.st_size;
+    while(end - p >= 4){
+        uint32_t rec_len;
+        memcpy(&rec_len, p, sizeof(rec_len));
+        if((size_t)(end - p - 4) < rec_len) break;          // torn record at the tail of the journal
+        const char *rec = p + 4, *rec_end = rec + rec_len;
+        p = rec_end;
+        if(rec_len < 13) break;
+        uint8_t type = rec[0];
+        int64_t timestamp;
+        int32_t num;
+        memcpy(&timestamp, rec + 1, sizeof(timestamp));
+        memcpy(&num, rec + 9, sizeof(num));
+        rec += 13;
+        char *name = journal_field(&rec, rec_end, 4);
+        char *author = name ? journal_field(&rec, rec_end, 4) : NULL;
+        char *note = author ? journal_field(&rec, rec_end, 4) : NULL;
+        uint64_t data_len = 0;
+        if(note && rec_end - rec >= 8) memcpy(&data_len, rec, sizeof(data_len));
+        char *data = note ? journal_field(&rec, rec_end, 8) : NULL;
+        if(!data){
+            free(name);
+            free(author);
+            free(note);
             break;
         }
-        else{
-            printf("Invalid command or incorrect usage. Type 'help' to see available commands.\n");
+        replay_time = timestamp;
+        switch(type){
+            case J_ADD: add_content(name, data, data_len, author, note); data = NULL; break;
+            case J_DELETE: delete_file(name); break;
+            case J_RECOVER: recover_file(name); break;
+            case J_REVERT: revert_file(name, num); break;
+            case J_SNAPSHOT: create_snapshot(name); break;
+            case J_ROLLBACK: rollback(num); break;
+            case J_DELETESNAP: delete_snapshot(name); break;
+            case J_OBSOLETESNAP: obsolete_snapshot(name); break;
+            case J_RECOVERSNAP: recover_snapshot(num); break;
+            case J_RETENTION: if(num >= 0) retention = num; break;
+            case J_HOT: if(num >= 1) hot_versions = num; break;
+        }
+        free(name);
+        free(author);
+        free(note);
+        free(data);
+        applied++;
+    }
+    replaying = 0;
+    fclose(cmd_out);
+    cmd_out = saved_out;
+    journal_size = p - map;
+    if(p != end && truncate(jname, journal_size) != 0){
+        print_errno("Error truncating journal");
+    }
+    munmap(map, st.st_size);
+    return applied;
+}
+
+// changes a tunable of the file system
+int set_option(const char *key, const char *value){
+    if(strcmp(key, "keyframe") == 0){
+        int interval = atoi(value);
+        if(interval < 1){
+            fprintf(cmd_err, "Error: Keyframe interval must be at least 1\n");
+            return VFS_INVALID;
+        }
+        keyframe_interval = interval;
+        fprintf(cmd_out, "Keyframe interval set to %d.\n", keyframe_interval);
+        return VFS_OK;
+    }
+    if(strcmp(key, "hot") == 0){
+        int versions = atoi(value);
+        if(versions < 1){
+            fprintf(cmd_err, "Error: Hot versions must be at least 1\n");
+            return VFS_INVALID;
+        }
+        hot_versions = versions;
+        journal_append(J_HOT, versions, NULL, NULL, NULL, NULL, 0);
+        fprintf(cmd_out, "Hot versions set to %d, older versions move to the cold tier on a file's next change.\n", hot_versions);
+        return VFS_OK;
+    }
+    if(strcmp(key, "retention") == 0){
+        int versions = strcmp(value, "all") == 0 ? 0 : atoi(value);
+        if(versions < 1 && strcmp(value, "all") != 0){
+            fprintf(cmd_err, "Error: Retention must be all or at least 1 version\n");
+            return VFS_INVALID;
+        }
+        retention = versions;
+        journal_append(J_RETENTION, versions, NULL, NULL, NULL, NULL, 0);
+        fprintf(cmd_out, "Retention set to %s versions per file, applied on a file's next change.\n", value);
+        return VFS_OK;
+    }
+    if(strcmp(key, "journal") == 0){
+        bgsave_reap(1);
+        journal_mode = strcmp(value, "on") == 0;
+        journal.len = 0;
+        free(journal_base);
+        journal_base = NULL;
+        fprintf(cmd_out, "Journal mode %s, the next save writes a full state image.\n", journal_mode ? "on" : "off");
+        return VFS_OK;
+    }
+    if(strcmp(key, "codec") == 0){
+        int codec = strcmp(value, "auto") == 0 ? CODEC_AUTO : -1;
+        for(int c = 0; c < CODEC_COUNT; c++){
+            if(strcmp(value, codecs[c].name) == 0) codec = c;
+        }
+        if(codec < 0){
+            fprintf(cmd_err, "Error: Codec must be auto, none, fast or high\n");
+            return VFS_INVALID;
+        }
+        codec_choice = codec;
+        fprintf(cmd_out, "Codec set to %s for content stored from now on.\n", value);
+        return VFS_OK;
+    }
+    if(strcmp(key, "cache") == 0){
+        char *end = NULL;
+        unsigned long long bytes = strcmp(value, "off") == 0 ? 0 : strtoull(value, &end, 10);
+        int shift = !end ? 0 : *end == 'k' ? 10 : *end == 'm' ? 20 : *end == 'g' ? 30 : *end ? -1 : 0;
+        if(end == value || shift < 0 || (end && shift && end[1]) || bytes > (SIZE_MAX >> shift)){
+            fprintf(cmd_err, "Error: Cache size must be off or a byte count, optionally with a k, m or g suffix\n");
+            return VFS_INVALID;
+        }
+        pthread_mutex_lock(&cache_lock);
+        cache_budget = (size_t)bytes << shift;
+        cache_trim();
+        pthread_mutex_unlock(&cache_lock);
+        fprintf(cmd_out, "Content cache set to %zu bytes.\n", cache_budget);
+        return VFS_OK;
+    }
+    if(strcmp(key, "verify") == 0){
+        if(strcmp(value, "content") != 0 && strcmp(value, "tables") != 0){
+            fprintf(cmd_err, "Error: Verify must be content or tables\n");
+            return VFS_INVALID;
+        }
+        verify_content = strcmp(value, "content") == 0;
+        fprintf(cmd_out, "Loads check the checksums of %s.\n", verify_content ? "tables, cold section and content" : "tables only");
+        return VFS_OK;
+    }
+    if(strcmp(key, "stats") == 0){
+        stats_enabled = strcmp(value, "on") == 0;
+        fprintf(cmd_out, "Command timing %s.\n", stats_enabled ? "on" : "off");
+        return VFS_OK;
+    }
+    if(strcmp(key, "workers") == 0){
+        int count = atoi(value);
+        if(count < 1 || count > MAX_WORKERS){
+            fprintf(cmd_err, "Error: Worker count must be between 1 and %d\n", MAX_WORKERS);
+            return VFS_INVALID;
+        }
+        pool_stop();
+        worker_count = count;
+        fprintf(cmd_out, "Worker count set to %d.\n", worker_count);
+        return VFS_OK;
+    }
+    fprintf(cmd_err, "Error: Unknown option '%s'\n", key);
+    return VFS_INVALID;
+}
+
+// help for interactive command-line execution
+void help(){
+    fprintf(cmd_out, "***** Available commands *****\n");
+    fprintf(cmd_out, "add <file_name> <file_path> <author> <note>     ---> Add a new file\n");
+    fprintf(cmd_out, "import <dir> <author> <note> [<tag>]            ---> Add every file below a directory, then snapshot\n");
+    fprintf(cmd_out, "viewfs                                          ---> View all files\n");
+    fprintf(cmd_out, "view <file_name>                                ---> View latest file content\n");
+    fprintf(cmd_out, "viewfs @<time>                                  ---> View the files present at a time\n");
+    fprintf(cmd_out, "view <file_name> @<time>                        ---> View file content as it was at a time\n");
+    fprintf(cmd_out, "delete <file_name>                              ---> Delete a file\n");
+    fprintf(cmd_out, "recover <file_name> <user>                      ---> Recover a deleted file\n");
+    fprintf(cmd_out, "log <file_name>                                 ---> View log history\n");
+    fprintf(cmd_out, "snapshot <tag>                                  ---> Create snapshot\n");
+    fprintf(cmd_out, "rollback <index>                                ---> Rollback to snapshot\n");
+    fprintf(cmd_out, "deletesnap <tag>                                ---> Delete snapshot\n");
+    fprintf(cmd_out, "obsoletesnap <tag>                              ---> Obsolete snapshot\n");
+    fprintf(cmd_out, "recoversnap <index>                             ---> Recover snapshot\n");
+    fprintf(cmd_out, "listsnap                                        ---> List snapshots\n");
+    fprintf(cmd_out, "revert <file_name> <version>                    ---> Revert file to version\n");
+    fprintf(cmd_out, "diff <file_name> <version> <version>            ---> Show line changes between two versions\n");
+    fprintf(cmd_out, "diffsnap <index> <index>                        ---> List files changed between two snapshots\n");
+    fprintf(cmd_out, "checkout <index> <dir> [--incremental]          ---> Write the files of a snapshot below a directory\n");
+    fprintf(cmd_out, "grep <text> [--all-versions] [--snapshot <i>]   ---> List the versions holding a text\n");
+    fprintf(cmd_out, "save <filename>                                 ---> Save state to disk\n");
+    fprintf(cmd_out, "bgsave <filename>                               ---> Save state to disk while commands keep running\n");
+    fprintf(cmd_out, "load <filename>                                 ---> Load state from disk\n");
+    fprintf(cmd_out, "verify [<filename>]                             ---> Check a state file's checksums, or the store in memory\n");
+    fprintf(cmd_out, "set keyframe <n>                                ---> Store every n-th version of a file in full\n");
+    fprintf(cmd_out, "set hot <n>                                     ---> Keep the latest n versions of a file in memory\n");
+    fprintf(cmd_out, "set retention <n|all>                           ---> Keep at most n versions of a file\n");
+    fprintf(cmd_out, "set journal <on|off>                            ---> Make saves append changes to a journal\n");
+    fprintf(cmd_out, "set codec <auto|none|fast|high>                 ---> Compress content stored from now on\n");
+    fprintf(cmd_out, "set cache <bytes[k|m|g]|off>                    ---> Keep up to that much unpacked content in memory\n");
+    fprintf(cmd_out, "set verify <content|tables>                     ---> Check content checksums on load, or the tables only\n");
+    fprintf(cmd_out, "set stats <on|off>                              ---> Time every command for 'stats'\n");
+    fprintf(cmd_out, "set workers <n>                                 ---> Split loading and releasing state over n threads\n");
+    fprintf(cmd_out, "stats [json|prom|reset]                         ---> Show latencies, memory use and file I/O\n");
+    fprintf(cmd_out, "help                                            ---> Show this help\n");
+    fprintf(cmd_out, "exit                                            ---> Exit the program\n");
+    fprintf(cmd_out, "Run with --batch [script] to execute a script (default stdin) without prompts.\n");
+    fprintf(cmd_out, "Run with --serve <socket> [state] to keep the state in a daemon, --client <socket> to send it commands\n");
+    fprintf(cmd_out, "and --loadgen <socket> <clients> <requests> [<write_percent> <source>] to measure it.\n");
+    fprintf(cmd_out, "Run with --bench [files= size= edit= touch= history= snapshot= reads= seed= state=] to time the engine.\n");
+}
+
+// name batch mode prints for a command status
+static const char* status_name(int status){
+    static const char *names[] = {"ok", "not_found", "conflict", "invalid", "io_error"};
+    return names[status];
+}
+
+// splits a command line in place into at most MAX_ARGS words, returns the number of words
+static int split_args(char *line, char **args){
+    int argc = 0;
+    char *save = NULL;
+    char *token = strtok_r(line, " \t\r\n", &save);
+    while(token && argc < MAX_ARGS){
+        args[argc++] = token;
+        token = strtok_r(NULL, " \t\r\n", &save);
+    }
+    return argc;
+}
+
+// runs one command line other than exit, returns its status
+static int dispatch_command(int argc, char **args){
+    if(!shared_reader) bgsave_reap(0);
+    if(strcmp(args[0], "add") == 0 && argc == 5){
+        return add_file(args[1], args[2], args[3], args[4]);
+    }
+    else if(strcmp(args[0], "import") == 0 && (argc == 4 || argc == 5)){
+        return import_directory(args[1], args[2], args[3], argc == 5 ? args[4] : NULL);
+    }
+    else if(strcmp(args[0], "viewfs") == 0 && argc == 2 && args[1][0] == '@'){
+        return view_fileSystem_at(args[1] + 1);
+    }
+    else if(strcmp(args[0], "viewfs") == 0){
+        return view_fileSystem();
+    }
+    else if(strcmp(args[0], "view") == 0 && argc == 2){
+        return view_fileContent(args[1]);
+    }
+    else if(strcmp(args[0], "view") == 0 && argc == 3 && args[2][0] == '@'){
+        return view_at(args[1], args[2] + 1);
+    }
+    else if(strcmp(args[0], "delete") == 0 && argc == 2){
+        return delete_file(args[1]);
+    }
+    else if(strcmp(args[0], "recover") == 0 && argc == 2){
+        return recover_file(args[1]);
+    }
+    else if(strcmp(args[0], "log") == 0 && argc == 2){
+        return log_history(args[1]);
+    }
+    else if(strcmp(args[0], "snapshot") == 0 && argc == 2){
+        return create_snapshot(args[1]);
+    }
+    else if(strcmp(args[0], "rollback") == 0 && argc == 2){
+        return rollback(atoi(args[1]));
+    }
+    else if(strcmp(args[0], "deletesnap") == 0 && argc == 2){
+        return delete_snapshot(args[1]);
+    }
+    else if(strcmp(args[0], "obsoletesnap") == 0 && argc == 2){
+        return obsolete_snapshot(args[1]);
+    }
+    else if(strcmp(args[0], "recoversnap") == 0 && argc == 2){
+        return recover_snapshot(atoi(args[1]));
+    }
+    else if(strcmp(args[0], "listsnap") == 0){
+        return list_snapshots();
+    }
+    else if(strcmp(args[0], "revert") == 0 && argc == 3){
+        return revert_file(args[1], atoi(args[2]));
+    }
+    else if(strcmp(args[0], "diff") == 0 && argc == 4){
+        return diff_versions(args[1], atoi(args[2]), atoi(args[3]));
+    }
+    else if(strcmp(args[0], "diffsnap") == 0 && argc == 3){
+        return diff_snapshots(atoi(args[1]), atoi(args[2]));
+    }
+    else if(strcmp(args[0], "checkout") == 0 && (argc == 3 || (argc == 4 && strcmp(args[3], "--incremental") == 0))){
+        return checkout_snapshot(atoi(args[1]), args[2], argc == 4);
+    }
+    else if(strcmp(args[0], "grep") == 0 && argc >= 2){
+        int all_versions = 0, bad = 0;
+        const char *snapshot = NULL;
+        for(int a = 2; a < argc; a++){
+            if(strcmp(args[a], "--all-versions") == 0) all_versions = 1;
+            else if(strcmp(args[a], "--snapshot") == 0 && a + 1 < argc) snapshot = args[++a];
+            else bad = 1;
         }
+        if(!bad) return search_content(args[1], all_versions, snapshot);
+    }
+    else if(strcmp(args[0], "save") == 0 && argc == 2){
+        return save_to_disk(args[1]);
+    }
+    else if(strcmp(args[0], "bgsave") == 0 && argc == 2){
+        return bgsave(args[1]);
+    }
+    else if(strcmp(args[0], "load") == 0 && argc == 2){
+        return load_from_disk(args[1]);
+    }
+    else if(strcmp(args[0], "verify") == 0 && argc <= 2){
+        return argc == 2 ? verify_state(args[1]) : verify_store();
+    }
+    else if(strcmp(args[0], "set") == 0 && argc == 3){
+        return set_option(args[1], args[2]);
+    }
+    else if(strcmp(args[0], "stats") == 0 && argc <= 2){
+        return show_stats(argc == 2 ? args[1] : NULL);
+    }
+    else if(strcmp(args[0], "help") == 0){
+        help();
+        return VFS_OK;
+    }
+    fprintf(cmd_out, "Invalid command or incorrect usage. Type 'help' to see available commands.\n");
+    return VFS_INVALID;
+}
+
+// runs one command line other than exit, timing it unless 'set stats off'; returns its status
+static int run_command(int argc, char **args){
+    if(!stats_enabled) return dispatch_command(argc, args);
+    uint64_t start = clock_ns();
+    int status = dispatch_command(argc, args);
+    stats_record(command_stat(args[0]), clock_ns() - start);
+    return status;
+}
+
+// runs a whole script (stdin for NULL or "-") without prompts, up to its end or an exit command
+// the script is read in one piece and split in place; after each command's output a "= <line> <status>" line
+// reports how it went. Returns the number of commands that failed, or -1 when the script could not be read.
+static long run_batch(const char *path){
+    int fd = path && strcmp(path, "-") != 0 ? open(path, O_RDONLY) : STDIN_FILENO;
+    if(fd == -1){
+        print_errno("Error opening script");
+        return -1;
+    }
+    size_t len;
+    char *script = read_source(fd, &len);
+    if(fd != STDIN_FILENO) close(fd);
+    char *grown = script ? realloc(script, len + 1) : NULL;
+    if(!grown){
+        fprintf(cmd_err, "Error: Script couldn't be read.\n");
+        free(script);
+        return -1;
+    }
+    script = grown;
+    script[len] = '\0';
+
+    long failed = 0, line = 0;
+    char *p = script, *end = script + len;
+    while(p < end){
+        char *eol = memchr(p, '\n', end - p);
+        if(!eol) eol = end;
+        *eol = '\0';
+        line++;
+        char *args[MAX_ARGS];
+        int argc = split_args(p, args);
+        p = eol + 1;
+        if(argc == 0 || args[0][0] == '#') continue;
+        if(strcmp(args[0], "exit") == 0) break;
+        int status = run_command(argc, args);
+        fprintf(cmd_out, "= %ld %s\n", line, status_name(status));
+        if(status != VFS_OK) failed++;
+    }
+    free(script);
+    return failed;
+}
+
+// DAEMON: keeps the state resident and serves commands over an AF_UNIX stream socket
+// A request is one command line ending in '\n'. The response is "<status> <length>\n" followed by length
+// bytes holding everything the command printed, errors included. Commands that only read the state run in
+// parallel under a shared lock and see a consistent state; everything else runs alone under the exclusive lock.
+
+// whether a command only reads the state
+static int is_read_command(int argc, char **args){
+    const char *name = args[0], *arg = argc > 1 ? args[1] : NULL;
+    return strcmp(name, "view") == 0 || strcmp(name, "viewfs") == 0 || strcmp(name, "log") == 0
+        || strcmp(name, "listsnap") == 0 || strcmp(name, "diff") == 0 || strcmp(name, "diffsnap") == 0
+        || (strcmp(name, "stats") == 0 && (!arg || strcmp(arg, "reset") != 0)) || strcmp(name, "help") == 0
+        || (strcmp(name, "grep") == 0 && __atomic_load_n(&search_ready, __ATOMIC_ACQUIRE));
+}
+
+// writes all of len bytes to a socket, returns -1 once the peer is gone
+static int write_all(int fd, const char *data, size_t len){
+    while(len > 0){
+        ssize_t n = write(fd, data, len);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return -1;
+        data += n;
+        len -= n;
     }
     return 0;
 }
 
+// reads a response from the daemon: its status and the output (malloc'd, NUL terminated), -1 on a broken connection
+static int read_response(FILE *in, char **text, size_t *len){
+    int status;
+    if(fscanf(in, "%d %zu", &status, len) != 2 || fgetc(in) != '\n') return -1;
+    *text = malloc(*len + 1);
+    if(!*text){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    if(fread(*text, 1, *len, in) != *len){
+        free(*text);
+        return -1;
+    }
+    (*text)[*len] = '\0';
+    return status;
+}
+
+// connects to a daemon's socket, returns the connected descriptor or -1
+static int connect_daemon(const char *path){
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path)){
+        fprintf(cmd_err, "Error: Socket path '%s' is too long\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0){
+        print_errno("Error connecting to daemon");
+        if(fd != -1) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// serves the requests of one client until it disconnects or sends exit
+static void* serve_client(void *arg){
+    int fd = (int)(intptr_t)arg;
+    FILE *in = fdopen(dup(fd), "r");
+    char *line = NULL;
+    size_t cap = 0;
+    while(in && getline(&line, &cap, in) > 0){
+        char *args[MAX_ARGS];
+        int argc = split_args(line, args);
+        if(argc > 0 && strcmp(args[0], "exit") == 0) break;
+        char *text = NULL;
+        size_t len = 0;
+        cmd_out = cmd_err = open_memstream(&text, &len);
+        int status = VFS_OK, stop = 0;
+        if(argc > 0 && strcmp(args[0], "shutdown") == 0){
+            fprintf(cmd_out, "Daemon shutting down.\n");
+            stop = 1;
+        }
+        else if(argc > 0 && is_read_command(argc, args)){
+            pthread_rwlock_rdlock(&state_lock);
+            shared_reader = 1;
+            status = run_command(argc, args);
+            shared_reader = 0;
+            pthread_rwlock_unlock(&state_lock);
+        }
+        else if(argc > 0){
+            pthread_rwlock_wrlock(&state_lock);
+            status = run_command(argc, args);
+            pthread_rwlock_unlock(&state_lock);
+        }
+        fclose(cmd_out);
+        char header[64];
+        int header_len = snprintf(header, sizeof(header), "%d %zu\n", status, len);
+        int gone = write_all(fd, header, header_len) != 0 || write_all(fd, text, len) != 0;
+        free(text);
+        if(stop) shutdown(serve_socket, SHUT_RDWR);
+        if(gone || stop) break;
+    }
+    free(line);
+    if(in) fclose(in);
+    close(fd);
+    return NULL;
+}
+
+// runs the daemon on a socket path until a client sends shutdown; the state file, if given, is loaded first
+static int serve(const char *path, const char *state){
+    if(state && load_from_disk(state) != VFS_OK) return EXIT_FAILURE;
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path)){
+        fprintf(cmd_err, "Error: Socket path '%s' is too long\n", path);
+        return EXIT_FAILURE;
+    }
+    strcpy(addr.sun_path, path);
+    serve_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if(serve_socket == -1 || bind(serve_socket, (struct sockaddr *)&addr, sizeof(addr)) != 0
+       || listen(serve_socket, SERVE_BACKLOG) != 0){
+        print_errno("Error opening daemon socket");
+        return EXIT_FAILURE;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    fprintf(cmd_out, "Serving on %s\n", path);
+    fflush(cmd_out);
+    for(;;){
+        int fd = accept(serve_socket, NULL, NULL);
+        if(fd == -1){
+            if(errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+        pthread_t thread;
+        if(pthread_create(&thread, NULL, serve_client, (void *)(intptr_t)fd) != 0){
+            close(fd);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    // the exclusive lock is kept, so the remaining clients end with the process without running another command
+    pthread_rwlock_wrlock(&state_lock);
+    close(serve_socket);
+    unlink(path);
+    cleanup();
+    return EXIT_SUCCESS;
+}
+
+// sends every line of stdin to a daemon as a command, printing each response like batch mode does
+static int run_client(const char *path){
+    int fd = connect_daemon(path);
+    if(fd == -1) return EXIT_FAILURE;
+    FILE *in = fdopen(fd, "r");
+    char *line = NULL;
+    size_t cap = 0;
+    long failed = 0, count = 0;
+    ssize_t n;
+    while((n = getline(&line, &cap, stdin)) > 0){
+        count++;
+        char *args[MAX_ARGS];
+        char *copy = strdup(line);
+        int argc = split_args(copy, args);
+        int skip = argc == 0 || args[0][0] == '#', stop = argc > 0 && strcmp(args[0], "exit") == 0;
+        free(copy);
+        if(skip) continue;
+        if(line[n - 1] != '\n' && write_all(fd, line, n) == 0) write_all(fd, "\n", 1);
+        else write_all(fd, line, n);
+        if(stop) break;
+        char *text;
+        size_t len;
+        int status = read_response(in, &text, &len);
+        if(status < 0){
+            fprintf(cmd_err, "Error: Connection to the daemon was lost\n");
+            failed++;
+            break;
+        }
+        fwrite(text, 1, len, cmd_out);
+        fprintf(cmd_out, "= %ld %s\n", count, status_name(status));
+        if(status != VFS_OK) failed++;
+        free(text);
+    }
+    free(line);
+    fclose(in);
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// LOAD GENERATOR: clients issuing a read-mostly mix of commands against a daemon
+typedef struct{
+    const char* path;                          // daemon socket
+    char** names;                              // files the commands pick from
+    int name_count;
+    long requests;                             // commands each client sends
+    int write_percent;                         // share of commands that add a new version
+    const char* source;                        // file the added versions are read from
+    unsigned seed;                             // per-client random state
+    double* latency;                           // out: microseconds per command
+    long failed;                               // out: commands that did not succeed
+}LoadClient;
+
+// seconds on a monotonic clock
+static double monotonic_seconds(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// one load generator client: a connection sending its share of commands one at a time
+static void* load_client(void *arg){
+    LoadClient *client = arg;
+    cmd_err = stderr;
+    int fd = connect_daemon(client->path);
+    if(fd == -1){
+        client->failed = client->requests;
+        return NULL;
+    }
+    FILE *in = fdopen(fd, "r");
+    char request[8192];
+    for(long i = 0; i < client->requests; i++){
+        const char *name = client->names[rand_r(&client->seed) % client->name_count];
+        int pick = rand_r(&client->seed) % 100;
+        int len;
+        if(pick < client->write_percent) len = snprintf(request, sizeof(request), "add %s %s loadgen load\n", name, client->source);
+        else if(pick % 2) len = snprintf(request, sizeof(request), "view %s\n", name);
+        else len = snprintf(request, sizeof(request), "log %s\n", name);
+        double start = monotonic_seconds();
+        char *text;
+        size_t text_len;
+        int status = write_all(fd, request, len) == 0 ? read_response(in, &text, &text_len) : -1;
+        client->latency[i] = (monotonic_seconds() - start) * 1e6;
+        if(status < 0){
+            client->failed += client->requests - i;
+            break;
+        }
+        if(status != VFS_OK) client->failed++;
+        free(text);
+    }
+    fclose(in);
+    return NULL;
+}
+
+// orders latencies for the percentiles
+static int compare_double(const void *a, const void *b){
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// drives a daemon with clients parallel connections of requests commands each and reports throughput and latency
+// write_percent of the commands add a version of a random file from source, the rest view or log one
+static int run_loadgen(const char *path, int clients, long requests, int write_percent, const char *source){
+    if(clients < 1 || requests < 1 || write_percent < 0 || write_percent > 100 || (write_percent > 0 && !source)){
+        fprintf(cmd_err, "Error: Usage: --loadgen <socket> <clients> <requests> [<write_percent> <source>]\n");
+        return EXIT_FAILURE;
+    }
+    int fd = connect_daemon(path);
+    if(fd == -1) return EXIT_FAILURE;
+    FILE *in = fdopen(fd, "r");
+    char *listing;
+    size_t listing_len;
+    if(write_all(fd, "viewfs\n", 7) != 0 || read_response(in, &listing, &listing_len) < 0){
+        fprintf(cmd_err, "Error: Connection to the daemon was lost\n");
+        fclose(in);
+        return EXIT_FAILURE;
+    }
+    fclose(in);
+    char **names = NULL;
+    int target_count = 0;
+    char *save = NULL;
+    for(char *line = strtok_r(listing, "\n", &save); line; line = strtok_r(NULL, "\n", &save)){
+        if(strncmp(line, "File name:", 10) != 0) continue;
+        names = realloc(names, (target_count + 1) * sizeof(char *));
+        names[target_count++] = line + 10 + strspn(line + 10, " ");
+    }
+    if(target_count == 0){
+        fprintf(cmd_err, "Error: The daemon holds no files to query\n");
+        free(listing);
+        return EXIT_FAILURE;
+    }
+
+    LoadClient *load = calloc(clients, sizeof(LoadClient));
+    pthread_t *threads = malloc(clients * sizeof(pthread_t));
+    double *latency = malloc(clients * requests * sizeof(double));
+    if(!load || !threads || !latency){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    double start = monotonic_seconds();
+    for(int i = 0; i < clients; i++){
+        load[i] = (LoadClient){path, names, target_count, requests, write_percent, source, 7919u * (i + 1), latency + i * requests, 0};
+        pthread_create(&threads[i], NULL, load_client, &load[i]);
+    }
+    long failed = 0;
+    for(int i = 0; i < clients; i++){
+        pthread_join(threads[i], NULL);
+        failed += load[i].failed;
+    }
+    double elapsed = monotonic_seconds() - start;
+    long total = clients * requests;
+    qsort(latency, total, sizeof(double), compare_double);
+    fprintf(cmd_out, "{\"clients\": %d, \"requests\": %ld, \"failed\": %ld, \"write_percent\": %d, \"seconds\": %.3f, "
+                 "\"ops_per_sec\": %.0f, \"p50_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f}\n",
+            clients, total, failed, write_percent, elapsed, total / elapsed,
+            latency[total / 2], latency[(long)(total * 0.99)], latency[total - 1]);
+    free(latency);
+    free(threads);
+    free(load);
+    free(names);
+    free(listing);
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// next value of a splitmix64 sequence, keeps benchmark workloads identical across runs
+static uint64_t bench_random(uint64_t *state){
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// fills one BENCH_LINE line with words, so generated content compresses and deltas like text
+static void bench_line(char *line, uint64_t *rng){
+    static const char *words[] = {"file", "version", "snapshot", "log", "author", "note", "content", "delta",
+                                  "table", "page", "blob", "chunk", "index", "state", "journal", "record"};
+    int pos = 0;
+    while(pos < BENCH_LINE - 1){
+        uint64_t r = bench_random(rng);
+        const char *word = words[r % 16];
+        int len = strlen(word);
+        if(pos + len + 4 > BENCH_LINE - 1) break;
+        pos += sprintf(line + pos, "%s%u ", word, (unsigned)(r >> 32) % 100);
+    }
+    memset(line + pos, ' ', BENCH_LINE - 1 - pos);
+    line[BENCH_LINE - 1] = '\n';
+}
+
+// runs one benchmark operation, adding its latency to the phase and counting a failure
+static void bench_time(CommandStat *phase, long *failed, int status, uint64_t start){
+    stats_record(phase, clock_ns() - start);
+    if(status != VFS_OK) (*failed)++;
+}
+
+// drives the core functions with a synthetic workload and prints a JSON report
+// arguments are key=value: files, size (bytes per file), edit (percent of lines each new version rewrites),
+// touch (percent of files changed per round), history (rounds), snapshot (rounds between snapshots),
+// reads (views, as-of views and reverts), seed and state (file for save/load); other keys are passed to 'set'
+// rounds are stamped a minute apart from a fixed start, so as-of views land on every depth of the histories
+static int run_bench(int argc, char **argv){
+    long files = 1000, size = 8192, edit = 2, touch = 25, history = 8, snapshot_every = 2, reads = 0, seed = 1;
+    char state[4096];
+    snprintf(state, sizeof(state), "/tmp/vfs_bench_%d.bin", (int)getpid());
+    FILE *report = cmd_out;
+    cmd_out = fopen("/dev/null", "w");
+    if(!cmd_out){
+        print_errno("Error opening /dev/null");
+        return EXIT_FAILURE;
+    }
+    for(int i = 0; i < argc; i++){
+        char *eq = strchr(argv[i], '=');
+        if(!eq){
+            fprintf(cmd_err, "Error: Benchmark arguments are key=value, got '%s'\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        *eq = '\0';
+        const char *key = argv[i], *value = eq + 1;
+        long *target = strcmp(key, "files") == 0 ? &files : strcmp(key, "size") == 0 ? &size
+                     : strcmp(key, "edit") == 0 ? &edit : strcmp(key, "touch") == 0 ? &touch
+                     : strcmp(key, "history") == 0 ? &history : strcmp(key, "snapshot") == 0 ? &snapshot_every
+                     : strcmp(key, "reads") == 0 ? &reads : strcmp(key, "seed") == 0 ? &seed : NULL;
+        if(target) *target = atol(value);
+        else if(strcmp(key, "state") == 0) snprintf(state, sizeof(state), "%s", value);
+        else if(set_option(key, value) != VFS_OK) return EXIT_FAILURE;
+    }
+    if(files < 1 || size < BENCH_LINE || edit < 0 || edit > 100 || touch < 0 || touch > 100 || history < 0
+       || snapshot_every < 1 || reads < 0){
+        fprintf(cmd_err, "Error: Benchmark needs files >= 1, size >= %d, edit and touch in 0..100, history >= 0, snapshot >= 1\n", BENCH_LINE);
+        return EXIT_FAILURE;
+    }
+    if(reads == 0) reads = files;
+
+    static CommandStat phases[BENCH_PHASES] = {
+        {.name = "add"}, {.name = "update"}, {.name = "snapshot"}, {.name = "view"}, {.name = "revert"},
+        {.name = "rollback"}, {.name = "asof"}, {.name = "save"}, {.name = "load"}
+    };
+    uint64_t rng = seed;
+    long lines = size / BENCH_LINE, failed = 0;
+    char **content = malloc(files * sizeof(char *));
+    if(!content){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    char name[32], tag[32], when[32];
+    const time_t epoch = 1700000000;
+    fixed_time = epoch;
+
+    for(long f = 0; f < files; f++){
+        content[f] = malloc(lines * BENCH_LINE);
+        if(!content[f]){
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+        for(long l = 0; l < lines; l++) bench_line(content[f] + l * BENCH_LINE, &rng);
+        char *copy = malloc(lines * BENCH_LINE);
+        if(!copy){
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(copy, content[f], lines * BENCH_LINE);
+        snprintf(name, sizeof(name), "file%ld", f);
+        uint64_t start = clock_ns();
+        bench_time(&phases[BENCH_ADD], &failed, add_content(name, copy, lines * BENCH_LINE, "bench", "initial"), start);
+    }
+
+    long snapshots_taken = 0;
+    for(long round = 1; round <= history; round++){
+        fixed_time = epoch + round * 60;
+        for(long f = 0; f < files; f++){
+            if((long)(bench_random(&rng) % 100) >= touch) continue;
+            long changes = lines * edit / 100;
+            if(changes < 1 && edit > 0) changes = 1;
+            for(long c = 0; c < changes; c++){
+                bench_line(content[f] + (bench_random(&rng) % lines) * BENCH_LINE, &rng);
+            }
+            char *copy = malloc(lines * BENCH_LINE);
+            if(!copy){
+                fprintf(stderr, "Error: Memory allocation failed\n");
+                exit(EXIT_FAILURE);
+            }
+            memcpy(copy, content[f], lines * BENCH_LINE);
+            snprintf(name, sizeof(name), "file%ld", f);
+            uint64_t start = clock_ns();
+            bench_time(&phases[BENCH_UPDATE], &failed, add_content(name, copy, lines * BENCH_LINE, "bench", "edit"), start);
+        }
+        if(round % snapshot_every == 0){
+            snprintf(tag, sizeof(tag), "round%ld", round);
+            uint64_t start = clock_ns();
+            bench_time(&phases[BENCH_SNAPSHOT], &failed, create_snapshot(tag), start);
+            snapshots_taken++;
+        }
+    }
+    fixed_time = 0;
+    for(long f = 0; f < files; f++) free(content[f]);
+    free(content);
+
+    for(long r = 0; r < reads; r++){
+        snprintf(name, sizeof(name), "file%ld", (long)(bench_random(&rng) % files));
+        uint64_t start = clock_ns();
+        bench_time(&phases[BENCH_VIEW], &failed, view_fileContent(name), start);
+    }
+
+    // reverts are stamped a minute after the last round and as-of reads span it, so they read reverted files
+    // both before and after their reverts
+    fixed_time = epoch + (history + 1) * 60;
+    for(long r = 0; r < reads; r++){
+        long f = bench_random(&rng) % files;
+        snprintf(name, sizeof(name), "file%ld", f);
+        File *file = table_file(live, find_file(name));
+        int version = file ? 1 + (int)(bench_random(&rng) % file->log_count) : 1;
+        uint64_t start = clock_ns();
+        bench_time(&phases[BENCH_REVERT], &failed, revert_file(name, version), start);
+    }
+
+    // rollbacks follow a minute apart; the content a file had just before each is kept, and once the as-of
+    // reads have run across all of them, a read of that time has to show it or it counts as failed
+    long rollbacks_made = snapshots_taken * 4;
+    uint64_t *before = malloc((rollbacks_made + 1) * sizeof(uint64_t));
+    if(!before){
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    for(long r = 0; r < rollbacks_made; r++){
+        fixed_time = epoch + (history + 2 + r) * 60;
+        snprintf(name, sizeof(name), "file%ld", r % files);
+        before[r] = file_latest(table_file(live, find_file(name)))->content->hash;
+        uint64_t start = clock_ns();
+        bench_time(&phases[BENCH_ROLLBACK], &failed, rollback((int)(bench_random(&rng) % snapshots_taken)), start);
+    }
+    fixed_time = 0;
+
+    for(long r = 0; r < reads; r++){
+        snprintf(name, sizeof(name), "file%ld", (long)(bench_random(&rng) % files));
+        snprintf(when, sizeof(when), "%lld", (long long)(epoch + bench_random(&rng) % ((history + 2 + rollbacks_made) * 60)));
+        uint64_t start = clock_ns();
+        bench_time(&phases[BENCH_ASOF], &failed, view_at(name, when), start);
+    }
+    for(long r = 0; r < rollbacks_made; r++){
+        time_t at = epoch + (history + 2 + r) * 60 - 1;
+        snprintf(name, sizeof(name), "file%ld", r % files);
+        const File *file = table_file(table_at(at), find_file(name));
+        int version = file ? version_at(file, at) : 0;
+        uint64_t hash = version < 1 ? 0 : version <= file->cold_count ? file->cold[version - 1].hash
+                                                                      : file->log_history[version - 1 - file->cold_count].content->hash;
+        if(hash != before[r]) failed++;
+    }
+    free(before);
+
+    struct stat st;
+    long state_bytes = 0;
+    for(int r = 0; r < 3; r++){
+        uint64_t start = clock_ns();
+        bench_time(&phases[BENCH_SAVE], &failed, save_to_disk(state), start);
+        if(stat(state, &st) == 0) state_bytes = st.st_size;
+        start = clock_ns();
+        bench_time(&phases[BENCH_LOAD], &failed, load_from_disk(state), start);
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    cleanup();
+    unlink(state);
+    fclose(cmd_out);
+    cmd_out = report;
+
+    fprintf(cmd_out, "{\"bench\": {\"files\": %ld, \"size\": %ld, \"edit\": %ld, \"touch\": %ld, \"history\": %ld, "
+                 "\"snapshot\": %ld, \"reads\": %ld, \"seed\": %ld, \"keyframe\": %d, \"codec\": \"%s\", \"workers\": %d},\n",
+            files, lines * BENCH_LINE, edit, touch, history, snapshot_every, reads, seed, keyframe_interval,
+            codec_choice == CODEC_AUTO ? "auto" : codecs[codec_choice].name, worker_count);
+    fprintf(cmd_out, " \"phases\": {\n");
+    for(int p = 0; p < BENCH_PHASES; p++){
+        const CommandStat *phase = &phases[p];
+        double seconds = phase->total_ns / 1e9;
+        fprintf(cmd_out, "  \"%s\": {\"ops\": %llu, \"seconds\": %.6f, \"ops_per_sec\": %.1f", phase->name,
+                (unsigned long long)phase->count, seconds, seconds > 0 ? phase->count / seconds : 0.0);
+        print_us(", \"p50_us\": %.3f", phase->count ? stats_percentile(phase, 0.5) : 0);
+        print_us(", \"p90_us\": %.3f", phase->count ? stats_percentile(phase, 0.9) : 0);
+        print_us(", \"p99_us\": %.3f", phase->count ? stats_percentile(phase, 0.99) : 0);
+        print_us(", \"max_us\": %.3f}", phase->max_ns);
+        fprintf(cmd_out, "%s\n", p + 1 < BENCH_PHASES ? "," : "");
+    }
+    fprintf(cmd_out, " },\n \"state_bytes\": %ld, \"peak_rss_kb\": %ld, \"failed\": %ld}\n", state_bytes, usage.ru_maxrss, failed);
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char *argv[]){
+    cmd_out = stdout;
+    cmd_err = stderr;
+    if(argc >= 2 && strcmp(argv[1], "--batch") == 0){
+        setvbuf(cmd_out, NULL, _IOFBF, BATCH_BUFFER);
+        cmd_err = cmd_out;    // errors share the buffer so each stays ahead of its command's status line
+        long failed = run_batch(argc >= 3 ? argv[2] : NULL);
+        cleanup();
+        return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if(argc >= 3 && strcmp(argv[1], "--serve") == 0){
+        return serve(argv[2], argc >= 4 ? argv[3] : NULL);
+    }
+    if(argc >= 3 && strcmp(argv[1], "--client") == 0){
+        return run_client(argv[2]);
+    }
+    if(argc >= 2 && strcmp(argv[1], "--bench") == 0){
+        return run_bench(argc - 2, argv + 2);
+    }
+    if(argc >= 5 && strcmp(argv[1], "--loadgen") == 0){
+        return run_loadgen(argv[2], atoi(argv[3]), atol(argv[4]), argc >= 6 ? atoi(argv[5]) : 0, argc >= 7 ? argv[6] : NULL);
+    }
+    char cmd[512];
+    fprintf(cmd_out, "------------------------------------ Version Based File System ------------------------------------ \n");
+    fprintf(cmd_out, "\nWelcome!...\n");
+    fprintf(cmd_out, "Starting the CLI...\n\n");
+    help();
+    while(1){
+        fprintf(cmd_out, "\n> ");
+        if(!fgets(cmd, sizeof(cmd), stdin)) break;
+        char *args[MAX_ARGS];
+        int count = split_args(cmd, args);
+        if(count == 0) continue;
+        if(strcmp(args[0], "exit") == 0){
+            cleanup();
+            fprintf(cmd_out, "Cleaning up...\n");
+            fprintf(cmd_out, "Exiting...\n");
+            break;
+        }
+        run_command(count, args);
+    }
+    return 0;
+}